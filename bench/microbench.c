@@ -0,0 +1,418 @@
+////////////////////////////////////////////////////////////////////////////
+//                          **** FAST-CHESS ****                          //
+//                     Trivial Chess Playing Program                      //
+//                    Copyright (c) 2020 David Bryant                     //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// microbench.c
+
+// Microbenchmarks for the engine's primitives (attack and pin detection, move
+// generation, making moves, position keys and the static evaluation), each
+// timed over a corpus of positions. Most of these are static, so this
+// includes fast-chess.c directly rather than linking with it. To build it
+// (from the top directory) for either move generator:
+//
+//   gcc -O3 bench/microbench.c -pthread -lm -o microbench
+//   gcc -O3 -DBITBOARDS bench/microbench.c bitboards.c -pthread -lm -o microbench
+//
+// The corpus is the positions in an EPD or FEN file given on the command
+// line, or otherwise positions from random games played from the start
+// position (which are the same every run). It's kept small enough to stay
+// in the caches, so that what's timed is the primitives and not memory.
+// The bitboard generator has no separate check_attack() or
+// set_pinned_status(), so those are only timed with the other one.
+
+#include "../fast-chess.c"
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#define MAX_CORPUS      512     // positions (few enough to stay in the caches)
+#define CORPUS_SPACING  7       // plies between the positions taken from random games
+#define NUM_SAMPLES     25      // timings of each primitive
+#define SAMPLE_NSECS    10000000LL      // about how long each timing runs
+
+typedef struct {
+    FRAME frame;
+    MOVE move;                  // a legal move, for make_move() and execute_move()
+} CORPUS_ENTRY;
+
+typedef struct {
+    const char *name;
+    long long (*pass) (void);   // run over the whole corpus once, returning the operations done
+} PRIMITIVE;
+
+static CORPUS_ENTRY *corpus;
+static int corpus_size;
+static uint64_t corpus_history [MAX_HISTORY];
+static unsigned int corpus_seed = 1;
+static volatile long long sink;     // results go here so they can't be optimized away
+
+static unsigned int corpus_random (void);
+static int add_position (FRAME *frame);
+static int load_corpus (FILE *in);
+static void random_corpus (void);
+static void run_primitive (PRIMITIVE *primitive);
+static long long current_nsecs (void);
+static long long current_cycles (void);
+static int compare_doubles (const void *a, const void *b);
+
+#ifndef BITBOARDS
+
+static long long pass_check_attack (void)
+{
+    long long result = 0;
+    int cindex, rank, file;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex) {
+        POSITION *pos = &corpus [cindex].frame.pos;
+
+        for (rank = 1; rank <= BOARD_SIDE; ++rank)
+            for (file = 1; file <= BOARD_SIDE; ++file)
+                result += check_attack (&SQUARE (pos, rank, file), pos->move_color ^ COLOR);
+    }
+
+    sink += result;
+    return (long long) corpus_size * BOARD_SIDE * BOARD_SIDE;
+}
+
+// set_pinned_status() marks the pinned pieces on the board, so they're
+// cleared again afterward the same way generate_move_list() does it
+
+static long long pass_set_pinned_status (void)
+{
+    long long result = 0;
+    square *pins [8];
+    int cindex, npins;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex) {
+        npins = set_pinned_status (&corpus [cindex].frame.pos, pins);
+        result += npins;
+
+        while (npins)
+            *pins [--npins] &= ~PINNED;
+    }
+
+    sink += result;
+    return corpus_size;
+}
+
+#endif
+
+static long long pass_generate_move_list (void)
+{
+    MOVE moves [MAX_MOVES + 10];
+    long long result = 0;
+    int cindex;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex)
+        result += generate_move_list (moves, &corpus [cindex].frame.pos);
+
+    sink += result;
+    return corpus_size;
+}
+
+static long long pass_generate_move_count (void)
+{
+    long long result = 0;
+    int cindex;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex)
+        result += generate_move_list (NULL, &corpus [cindex].frame.pos);
+
+    sink += result;
+    return corpus_size;
+}
+
+static long long pass_generate_capture_list (void)
+{
+    MOVE moves [MAX_MOVES + 10];
+    long long result = 0;
+    int cindex;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex)
+        result += generate_capture_list (moves, &corpus [cindex].frame.pos);
+
+    sink += result;
+    return corpus_size;
+}
+
+static long long pass_generate_quiet_list (void)
+{
+    MOVE moves [MAX_MOVES + 10];
+    long long result = 0;
+    int cindex;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex)
+        result += generate_quiet_list (moves, &corpus [cindex].frame.pos);
+
+    sink += result;
+    return corpus_size;
+}
+
+static long long pass_make_unmake_move (void)
+{
+    long long result = 0;
+    int cindex;
+    UNDO undo;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex) {
+        make_move (&corpus [cindex].frame, &corpus [cindex].move, &undo);
+        result += corpus [cindex].frame.pos.in_check;
+        unmake_move (&corpus [cindex].frame, &corpus [cindex].move, &undo);
+    }
+
+    sink += result;
+    return corpus_size;
+}
+
+// execute_move() can't be taken back, so it gets a copy of each frame (as
+// its callers that keep the original do)
+
+static long long pass_execute_move (void)
+{
+    long long result = 0;
+    FRAME temp;
+    int cindex;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex) {
+        temp = corpus [cindex].frame;
+        execute_move (&temp, &corpus [cindex].move);
+        result += temp.pos.in_check;
+    }
+
+    sink += result;
+    return corpus_size;
+}
+
+static long long pass_position_key (void)
+{
+    uint64_t result = 0;
+    int cindex;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex)
+        result ^= position_key (&corpus [cindex].frame.pos);
+
+    sink += (long long) (result & 0xffff);
+    return corpus_size;
+}
+
+static long long pass_evaluate (void)
+{
+    long long result = 0;
+    int cindex;
+
+    for (cindex = 0; cindex < corpus_size; ++cindex)
+        result += evaluate (&corpus [cindex].frame);
+
+    sink += result;
+    return corpus_size;
+}
+
+static PRIMITIVE primitives [] = {
+#ifndef BITBOARDS
+    { "check_attack", pass_check_attack },
+    { "set_pinned_status", pass_set_pinned_status },
+#endif
+    { "generate_move_list", pass_generate_move_list },
+    { "generate_move_list (no list)", pass_generate_move_count },
+    { "generate_capture_list", pass_generate_capture_list },
+    { "generate_quiet_list", pass_generate_quiet_list },
+    { "make_move + unmake_move", pass_make_unmake_move },
+    { "execute_move (frame copy)", pass_execute_move },
+    { "position_key", pass_position_key },
+    { "evaluate", pass_evaluate },
+};
+
+#define NUM_PRIMITIVES (int) (sizeof (primitives) / sizeof (primitives [0]))
+
+int main (argc, argv) int argc; char **argv;
+{
+    int pindex;
+
+    corpus = malloc (MAX_CORPUS * sizeof (CORPUS_ENTRY));
+
+    if (!corpus) {
+        fprintf (stderr, "can't allocate corpus!\n");
+        exit (1);
+    }
+
+    if (argc > 1) {
+        FILE *in = fopen (argv [1], "rt");
+
+        if (!in || !load_corpus (in)) {
+            fprintf (stderr, "no positions in file %s\n", argv [1]);
+            exit (1);
+        }
+
+        fclose (in);
+        printf ("corpus: %d positions from %s\n", corpus_size, argv [1]);
+    }
+    else {
+        random_corpus ();
+        printf ("corpus: %d positions from random games\n", corpus_size);
+    }
+
+#ifdef BITBOARDS
+    printf ("move generator: bitboards\n");
+#else
+    printf ("move generator: board\n");
+#endif
+#ifdef HAVE_RDTSC
+    printf ("cycles are time stamp counter ticks (a fixed rate, not the core clock)\n\n");
+    printf ("%-30s %8s %8s %8s %10s\n", "primitive", "ns/op", "min", "spread", "cycles/op");
+#else
+    printf ("\n%-30s %8s %8s %8s\n", "primitive", "ns/op", "min", "spread");
+#endif
+
+    for (pindex = 0; pindex < NUM_PRIMITIVES; ++pindex)
+        run_primitive (primitives + pindex);
+
+    free (corpus);
+    return 0;
+}
+
+// Time the specified primitive NUM_SAMPLES times, each over enough passes of
+// the corpus to take about SAMPLE_NSECS (after a pass to warm up the caches
+// and find how many that is). The result is the median time per operation,
+// the fastest, and the spread (the median absolute deviation from the median,
+// as a percentage of it), so a change in the cost of a primitive can be told
+// from noise.
+
+static void run_primitive (PRIMITIVE *primitive)
+{
+    double nsecs [NUM_SAMPLES], cycles [NUM_SAMPLES], deviations [NUM_SAMPLES], median;
+    long long start_nsecs, start_cycles, ops;
+    int sindex, passes, pass;
+
+    start_nsecs = current_nsecs ();
+    primitive->pass ();
+    passes = (int) (SAMPLE_NSECS / (current_nsecs () - start_nsecs + 1)) + 1;
+
+    for (sindex = 0; sindex < NUM_SAMPLES; ++sindex) {
+        start_nsecs = current_nsecs ();
+        start_cycles = current_cycles ();
+
+        for (ops = pass = 0; pass < passes; ++pass)
+            ops += primitive->pass ();
+
+        cycles [sindex] = (double) (current_cycles () - start_cycles) / ops;
+        nsecs [sindex] = (double) (current_nsecs () - start_nsecs) / ops;
+    }
+
+    qsort (nsecs, NUM_SAMPLES, sizeof (double), compare_doubles);
+    qsort (cycles, NUM_SAMPLES, sizeof (double), compare_doubles);
+    median = nsecs [NUM_SAMPLES / 2];
+
+    for (sindex = 0; sindex < NUM_SAMPLES; ++sindex)
+        deviations [sindex] = fabs (nsecs [sindex] - median);
+
+    qsort (deviations, NUM_SAMPLES, sizeof (double), compare_doubles);
+
+    printf ("%-30s %8.2f %8.2f %7.1f%%", primitive->name, median, nsecs [0],
+        median > 0.0 ? deviations [NUM_SAMPLES / 2] * 100.0 / median : 0.0);
+#ifdef HAVE_RDTSC
+    printf (" %10.1f", cycles [NUM_SAMPLES / 2]);
+#endif
+    printf ("\n");
+    fflush (stdout);
+}
+
+// Add the specified position to the corpus (with a random legal move to make
+// in it), unless it has no legal moves or the corpus is full.
+
+static int add_position (FRAME *frame)
+{
+    MOVE moves [MAX_MOVES + 10];
+    int nmoves;
+
+    if (corpus_size == MAX_CORPUS || !(nmoves = generate_move_list (moves, &frame->pos)))
+        return FALSE;
+
+    corpus [corpus_size].frame = *frame;
+    corpus [corpus_size].frame.history = corpus_history;
+    corpus [corpus_size].frame.flags = EVAL_POSITION;
+    corpus [corpus_size++].move = moves [corpus_random () % nmoves];
+    return TRUE;
+}
+
+// Load the corpus from a file of positions in FEN or EPD (one per line, with
+// anything after the position ignored), returning the number loaded.
+
+static int load_corpus (FILE *in)
+{
+    uint64_t history [MAX_HISTORY];
+    char line [1024];
+    FRAME frame;
+
+    while (corpus_size < MAX_CORPUS && fgets (line, sizeof (line), in))
+        if (*line != '#' && init_frame_fen (&frame, history, line))
+            add_position (&frame);
+
+    return corpus_size;
+}
+
+// Fill the corpus with every CORPUS_SPACING'th position from random games,
+// which go from the start position to a checkmate, stalemate or draw (or
+// move 100, so that there are enough games for some variety).
+
+static void random_corpus (void)
+{
+    uint64_t history [MAX_HISTORY];
+    MOVE moves [MAX_MOVES + 10];
+    int nmoves, plies = 0;
+    FRAME frame;
+
+    init_frame (&frame, history);
+
+    while (corpus_size < MAX_CORPUS) {
+        nmoves = generate_move_list (moves, &frame.pos);
+
+        if (!nmoves || frame.pos.drawn_game || frame.pos.move_number > 100) {
+            init_frame (&frame, history);
+            continue;
+        }
+
+        if (!(++plies % CORPUS_SPACING))
+            add_position (&frame);
+
+        execute_move (&frame, moves + corpus_random () % nmoves);
+    }
+}
+
+// a simple linear congruential generator, so that the corpus doesn't depend on rand()
+
+static unsigned int corpus_random (void)
+{
+    corpus_seed = corpus_seed * 1103515245U + 12345U;
+    return corpus_seed >> 8;
+}
+
+static long long current_nsecs (void)
+{
+    struct timespec time;
+
+    clock_gettime (CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+static long long current_cycles (void)
+{
+#ifdef HAVE_RDTSC
+    return (long long) __rdtsc ();
+#else
+    return 0;
+#endif
+}
+
+static int compare_doubles (const void *a, const void *b)
+{
+    double x = * (const double *) a, y = * (const double *) b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,616 @@
+////////////////////////////////////////////////////////////////////////////
+//                         **** FAST-CHESS ****                           //
+//                     Trivial Chess Playing Program                      //
+//                    Copyright (c) 2020 David Bryant                     //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// bitboards.c
+
+// This is an alternative move generator backend that's selected at build
+// time by defining BITBOARDS (e.g., gcc -O3 -DBITBOARDS *.c -pthread). The
+// board array is still maintained and used for everything else, but each
+// position also carries a bitboard for each piece type of each color, and
+// these are used to find the slider moves and for all the attack detection
+// (including the legality checks and in_check()), and to count mobility.
+// Slider attacks are looked up in tables indexed with the BMI2 PEXT
+// instruction if the CPU has it (checked at startup), or otherwise with
+// "magic" multipliers.
+//
+// The pieces to move are taken from the same piece lists that the board-based
+// generator in fast-chess.c uses, and the moves for each piece are generated
+// in the same order, so the two backends produce identical move lists (and
+// therefore identical searches).
+
+#include "fast-chess.h"
+
+#ifdef BITBOARDS
+
+#if defined (__GNUC__) && defined (__x86_64__) && !defined (NO_PEXT)
+#include <immintrin.h>
+#define USE_PEXT
+#endif
+
+#define LSB(bits) __builtin_ctzll (bits)
+#define MSB(bits) (63 - __builtin_clzll (bits))
+
+// board index <-> bit number conversions (border squares have no bit)
+
+uint64_t bb_masks [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
+static signed char bb_bits [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
+static unsigned char bb_index [64];
+
+static uint64_t knight_attacks [64], king_attacks [64], pawn_attacks [2] [64];
+
+// rays are in the same order as the board-based generator searches them:
+// DIAG1, DIAG2, DIAG3, DIAG4, ORTHOG1, ORTHOG2, ORTHOG3, ORTHOG4
+
+static const int ray_ranks [8] = { 1, 1, -1, -1, 0, 0, 1, -1 };
+static const int ray_files [8] = { 1, -1, 1, -1, 1, -1, 0, 0 };
+static const int ray_ascending [8] = { TRUE, TRUE, FALSE, FALSE, TRUE, FALSE, TRUE, FALSE };
+static uint64_t rays [8] [64];
+
+typedef struct {
+    uint64_t mask, magic, *attacks;
+    int shift;
+} SLIDER;
+
+static SLIDER bishop_sliders [64], rook_sliders [64];
+static uint64_t slider_table [0x19000 + 0x1480];
+
+// The magic multipliers map each square's relevant occupancy bits to a unique
+// table index (or at least to an index that has the same attacks). These were
+// found with a simple random search (sparse random numbers, keeping the first
+// one that works for each square).
+
+static const uint64_t bishop_magics [64] = {
+    0x8320604200504080ULL, 0x40082800808a0000ULL, 0x402908022084006aULL,
+    0x00044040800e2022ULL, 0x0002121000022000ULL, 0x0010880440000004ULL,
+    0x0014140108080100ULL, 0x008200290c122009ULL, 0x0440c04401940500ULL,
+    0x0083080260840501ULL, 0x2000044104110400ULL, 0x0480022082008302ULL,
+    0x04b6220210310290ULL, 0x46000c2220110040ULL, 0x80280200a4044000ULL,
+    0x1008450092012088ULL, 0x80240210110a0810ULL, 0x1004000801483201ULL,
+    0x000c20c808011010ULL, 0x004400c840102210ULL, 0x0000801405a04012ULL,
+    0x0000202200842000ULL, 0x0008400482082084ULL, 0x0111030a20821084ULL,
+    0x0018408204700a10ULL, 0x0021040090648812ULL, 0x0112020401180200ULL,
+    0x206480202e020200ULL, 0x2002002006008040ULL, 0x008046004104820cULL,
+    0x1206020040491030ULL, 0x0203822802090408ULL, 0x9214020b20202040ULL,
+    0x0020882428181014ULL, 0x0004060800044040ULL, 0x2090440108040100ULL,
+    0x0010020080001004ULL, 0x24041802000420a0ULL, 0x040800a10a108818ULL,
+    0x000a040022064200ULL, 0x0040842008002022ULL, 0x0082080114007808ULL,
+    0x0900120501011000ULL, 0x000804c208050080ULL, 0x1010c08810410200ULL,
+    0x8022042800201600ULL, 0x41104407140802e0ULL, 0x1001410d16020100ULL,
+    0x8804480430084140ULL, 0x0000210802100008ULL, 0x0010002412084110ULL,
+    0x0400014884041200ULL, 0x041c000505040182ULL, 0x90602002021a1002ULL,
+    0x02082011c2020100ULL, 0x2042128801050408ULL, 0x3910410250300412ULL,
+    0x2000088680901018ULL, 0x0100012042280424ULL, 0x0080000040411080ULL,
+    0x0000440008030c00ULL, 0x4808000410620200ULL, 0x40000a200410820cULL,
+    0x0002101a04810a00ULL,
+};
+
+static const uint64_t rook_magics [64] = {
+    0x0080024004816012ULL, 0x0240004020001000ULL, 0x318020009001800aULL,
+    0x02000a0020100440ULL, 0x4280080004002280ULL, 0x020010010200c408ULL,
+    0x0c80020001000080ULL, 0x0600040090220041ULL, 0x1000800080204002ULL,
+    0x0008401000200040ULL, 0x2080801000200080ULL, 0x0008801000800802ULL,
+    0x0010800800040080ULL, 0x1021000802040100ULL, 0x8004001088211204ULL,
+    0x0412800048800100ULL, 0x0020008080004000ULL, 0x0000808040002008ULL,
+    0x10aa020020401080ULL, 0x0008220010084202ULL, 0x0148010010090004ULL,
+    0x0003010002080400ULL, 0x8002808001000200ULL, 0x003802000048810cULL,
+    0x0200842280004010ULL, 0x2880500140002008ULL, 0x0280100080802000ULL,
+    0x0840210900100102ULL, 0x0000040080800800ULL, 0x0401000300040008ULL,
+    0x0100f80400010210ULL, 0x8500004200040081ULL, 0xc010400090800022ULL,
+    0x0028201000404000ULL, 0x38c0108042002205ULL, 0x1421023003002028ULL,
+    0x8000800400800800ULL, 0x0421100408014020ULL, 0x20d1000401000200ULL,
+    0x00080041020000a4ULL, 0x8000804000208000ULL, 0x0010044020134000ULL,
+    0x0020008110028024ULL, 0x8108008150028018ULL, 0x2024008008008004ULL,
+    0x0001000400030008ULL, 0x3002000100404080ULL, 0xa26901029046001cULL,
+    0x0800408102002200ULL, 0x9130882000400480ULL, 0x0220004029001100ULL,
+    0x4800080010008080ULL, 0x0400800400080080ULL, 0x4504000200410040ULL,
+    0x0040080192300400ULL, 0x8c82204401089200ULL, 0x00012300c2108005ULL,
+    0x2080124080260106ULL, 0x5020004110a30029ULL, 0x0000041001012009ULL,
+    0x3142010420081082ULL, 0x1415000400028801ULL, 0x0800294088100204ULL,
+    0x0004010c0026814aULL,
+};
+
+static uint64_t (*bishop_attacks) (int bit, uint64_t occupied);
+static uint64_t (*rook_attacks) (int bit, uint64_t occupied);
+
+static pthread_once_t bitboard_once = PTHREAD_ONCE_INIT;
+
+static void init_bitboards (void);
+
+// Initialize the bitboards of the specified position from its board array.
+// This must be called whenever the board array is set up from scratch.
+
+void bb_setup (POSITION *pos)
+{
+    int rank, file;
+
+    pthread_once (&bitboard_once, init_bitboards);
+    memset (pos->bitboards, 0, sizeof (pos->bitboards));
+
+    for (rank = 1; rank <= BOARD_SIDE; ++rank)
+        for (file = 1; file <= BOARD_SIDE; ++file) {
+            int piece = SQUARE (pos, rank, file);
+
+            if (piece & PIECE) {
+                pos->bitboards [(piece & COLOR) >> 3] [piece & PIECE] |= bb_masks [INDEX (rank, file)];
+                pos->bitboards [(piece & COLOR) >> 3] [0] |= bb_masks [INDEX (rank, file)];
+            }
+        }
+}
+
+// Return TRUE if the specified square (bit number) is attacked by a piece of
+// the specified color with the specified occupancy, ignoring any pieces in
+// "removed" (which is how a captured piece is taken out of the picture).
+
+static int attacked (POSITION *pos, int bit, int color, uint64_t occupied, uint64_t removed)
+{
+    uint64_t *them = pos->bitboards [color >> 3];
+
+    if (((pawn_attacks [!color] [bit] & them [PAWN]) |
+        (knight_attacks [bit] & them [KNIGHT]) |
+        (king_attacks [bit] & them [KING])) & ~removed)
+            return TRUE;
+
+    if (bishop_attacks (bit, occupied) & (them [BISHOP] | them [QUEEN]) & ~removed)
+        return TRUE;
+
+    return (rook_attacks (bit, occupied) & (them [ROOK] | them [QUEEN]) & ~removed) != 0;
+}
+
+int bb_in_check (POSITION *pos)
+{
+    int kindex = pos->move_color ? pos->black_king : pos->white_king;
+
+    return attacked (pos, bb_bits [kindex], pos->move_color ^ COLOR,
+        pos->bitboards [0] [0] | pos->bitboards [1] [0], 0);
+}
+
+// Return the number of squares attacked by the pieces of the specified color
+// that aren't occupied by its own pieces (counting each piece's attacks), which
+// is the same count that the board-based count_mobility() makes.
+
+int bb_mobility (POSITION *pos, int color)
+{
+    uint64_t *own = pos->bitboards [color >> 3], occupied = own [0] | pos->bitboards [(color >> 3) ^ 1] [0], targets;
+    int pindex, mobility = 0;
+
+    for (pindex = 0; pindex < pos->piece_counts [color >> 3]; ++pindex) {
+        int index = pos->piece_lists [color >> 3] [pindex], bit = bb_bits [index];
+
+        switch (pos->board [index] & PIECE) {
+
+            case PAWN:
+                targets = pawn_attacks [color >> 3] [bit];
+                break;
+
+            case KNIGHT:
+                targets = knight_attacks [bit];
+                break;
+
+            case KING:
+                targets = king_attacks [bit];
+                break;
+
+            case BISHOP:
+                targets = bishop_attacks (bit, occupied);
+                break;
+
+            case ROOK:
+                targets = rook_attacks (bit, occupied);
+                break;
+
+            default:
+                targets = bishop_attacks (bit, occupied) | rook_attacks (bit, occupied);
+                break;
+        }
+
+        mobility += __builtin_popcountll (targets & ~own [0]);
+    }
+
+    return mobility;
+}
+
+// Return TRUE if moving the piece on "from" to "to" (capturing whatever is on
+// "cap", which is different from "to" only for en passant) would not leave
+// the king on "king" in check.
+
+static int legal (POSITION *pos, int from, int to, int cap, int king)
+{
+    uint64_t occupied = pos->bitboards [0] [0] | pos->bitboards [1] [0];
+
+    occupied = (occupied ^ bb_masks [from] ^ bb_masks [cap]) | bb_masks [to];
+
+    return !attacked (pos, bb_bits [king == from ? to : king], pos->move_color ^ COLOR,
+        occupied, bb_masks [cap]);
+}
+
+// Return the pieces of the side to move that are pinned against their king,
+// by looking along each ray from the king for one of our pieces followed by
+// an enemy slider that moves along that ray.
+
+static uint64_t pinned_pieces (POSITION *pos, int kbit, uint64_t occupied)
+{
+    uint64_t *them = pos->bitboards [(pos->move_color >> 3) ^ 1];
+    uint64_t own = pos->bitboards [pos->move_color >> 3] [0], pinned = 0;
+    int dir;
+
+    for (dir = 0; dir < 8; ++dir) {
+        uint64_t sliders = (them [QUEEN] | them [dir < 4 ? BISHOP : ROOK]) & rays [dir] [kbit];
+        uint64_t blockers = rays [dir] [kbit] & occupied;
+        int first, second;
+
+        if (!sliders)
+            continue;
+
+        first = ray_ascending [dir] ? LSB (blockers) : MSB (blockers);
+
+        if (!((own >> first) & 1) || !(blockers ^= 1ULL << first))
+            continue;
+
+        second = ray_ascending [dir] ? LSB (blockers) : MSB (blockers);
+
+        if ((sliders >> second) & 1)
+            pinned |= 1ULL << first;
+    }
+
+    return pinned;
+}
+
+// These macros add moves to the list, checking their legality first if the
+// piece is pinned or we're in check. Slider moves are taken from the target
+// squares one ray at a time, starting with the square closest to the piece.
+
+#define addmove(to)                                                     \
+    if (!check || legal (pos, move.from, to, to, kindex)) {             \
+        move.delta = (to) - move.from;                                  \
+        *listptr++ = move;                                              \
+    }
+
+#define addpath(dir)                                                    \
+    for (ray = targets & rays [dir] [bit]; ray; ray ^= 1ULL << tbit) {  \
+        tbit = ray_ascending [dir] ? LSB (ray) : MSB (ray);             \
+        addmove (bb_index [tbit]);                                      \
+    }
+
+#define addstep(dir)                                                    \
+    if (bb_masks [move.from + (dir)] & allowed)                         \
+        addmove (move.from + (dir));
+
+#define addpmove(to)                                                    \
+    if (!check || legal (pos, move.from, to, to, kindex)) {             \
+        move.delta = (to) - move.from;                                  \
+                                                                        \
+        if (rank == 9 - startrank)                                      \
+            for (move.promo = KNIGHT; move.promo &= PIECE; ++move.promo)\
+                *listptr++ = move;                                      \
+        else                                                            \
+            *listptr++ = move;                                          \
+    }
+
+#define addpepx(dir, epdir)                                             \
+    if (move.from + (epdir) == epsquare &&                              \
+        legal (pos, move.from, move.from + (dir), epsquare, kindex)) {  \
+            move.delta = (dir);                                         \
+            *listptr++ = move;                                          \
+    }
+
+// Generate the legal moves in the specified position (ALL_MOVES), or just the
+// moves onto squares occupied by the other side (CAPTURES, so not castling,
+// pawn pushes, or en passant), or just the rest (QUIETS), in the same order.
+
+#define ALL_MOVES   0
+#define CAPTURES    1
+#define QUIETS      2
+
+static int generate_moves (MOVE list [], POSITION *pos, int mode)
+{
+    uint64_t *own = pos->bitboards [pos->move_color >> 3], *them = pos->bitboards [(pos->move_color >> 3) ^ 1];
+    int kindex = pos->move_color ? pos->black_king : pos->white_king, bit, tbit, check, pindex;
+    uint64_t occupied = own [0] | them [0], allowed = mode == CAPTURES ? them [0] : mode == QUIETS ? ~occupied : ~own [0];
+    uint64_t pinned = 0, targets, ray;
+    MOVE local_list [MAX_MOVES + 10], *listptr, move;
+
+    if (!list)
+        listptr = list = local_list;
+    else
+        listptr = list;
+
+    if (!pos->in_check)
+        pinned = pinned_pieces (pos, bb_bits [kindex], occupied);
+
+    move.promo = 0;
+
+    for (pindex = 0; pindex < pos->piece_counts [pos->move_color >> 3]; ++pindex) {
+        square *src = &pos->board [move.from = pos->piece_lists [pos->move_color >> 3] [pindex]];
+
+        bit = bb_bits [move.from];
+
+        check = pos->in_check || ((pinned >> bit) & 1);
+
+        switch (*src & PIECE) {
+
+            case BISHOP:
+            case QUEEN:
+
+                targets = bishop_attacks (bit, occupied) & allowed;
+
+                addpath (0);
+                addpath (1);
+                addpath (2);
+                addpath (3);
+
+                if ((*src & PIECE) == BISHOP)
+                    break;
+
+            case ROOK:
+
+                targets = rook_attacks (bit, occupied) & allowed;
+
+                addpath (4);
+                addpath (5);
+                addpath (6);
+                addpath (7);
+                break;
+
+            case KNIGHT:
+
+                if ((pinned >> bit) & 1)
+                    break;
+
+                addstep (KNIGHT1);
+                addstep (KNIGHT2);
+                addstep (KNIGHT3);
+                addstep (KNIGHT4);
+                addstep (KNIGHT5);
+                addstep (KNIGHT6);
+                addstep (KNIGHT7);
+                addstep (KNIGHT8);
+                break;
+
+            case KING:
+
+                check = TRUE;
+
+                addstep (ORTHOG1);
+                addstep (ORTHOG2);
+                addstep (ORTHOG3);
+                addstep (ORTHOG4);
+                addstep (DIAG1);
+                addstep (DIAG2);
+                addstep (DIAG3);
+                addstep (DIAG4);
+
+                if (mode != CAPTURES && !pos->in_check && !(*src & MOVED)) {
+
+                    if (!src [1] && !src [2] &&
+                        ((src [3] & (PIECE | MOVED)) == ROOK) &&
+                        !attacked (pos, bit + 1, pos->move_color ^ COLOR, occupied, 0) &&
+                        !attacked (pos, bit + 2, pos->move_color ^ COLOR, occupied, 0)) {
+
+                            move.delta = KINGOO;
+                            *listptr++ = move;
+                    }
+
+                    if (!src [-1] && !src [-2] && !src [-3] &&
+                        ((src [-4] & (PIECE | MOVED)) == ROOK) &&
+                        !attacked (pos, bit - 1, pos->move_color ^ COLOR, occupied, 0) &&
+                        !attacked (pos, bit - 2, pos->move_color ^ COLOR, occupied, 0)) {
+
+                            move.delta = KINGOOO;
+                            *listptr++ = move;
+                    }
+                }
+
+                break;
+
+            case PAWN: {
+                int rank = (bit >> 3) + 1, startrank, epsquare, push, cap1, cap2, epx1, epx2;
+
+                if (pos->move_color) {
+                    startrank = BPRANK; epsquare = pos->white_epsquare;
+                    push = BPAWN1; cap1 = BPCAP1; cap2 = BPCAP2; epx1 = BPEPX1; epx2 = BPEPX2;
+                }
+                else {
+                    startrank = WPRANK; epsquare = pos->black_epsquare;
+                    push = WPAWN1; cap1 = WPCAP1; cap2 = WPCAP2; epx1 = WPEPX1; epx2 = WPEPX2;
+                }
+
+                if (mode != CAPTURES && !src [push]) {
+                    addpmove (move.from + push);
+
+                    if (rank == startrank && !src [push + push])
+                        addmove (move.from + push + push);
+                }
+
+                if (mode != QUIETS && (bb_masks [move.from + cap1] & them [0]))
+                    addpmove (move.from + cap1);
+
+                if (mode != QUIETS && (bb_masks [move.from + cap2] & them [0]))
+                    addpmove (move.from + cap2);
+
+                if (mode != CAPTURES) {
+                    addpepx (cap1, epx1);
+                    addpepx (cap2, epx2);
+                }
+
+                break;
+            }
+        }
+    }
+
+    return listptr - list;
+}
+
+int generate_move_list (MOVE list [], POSITION *pos)
+{
+    return generate_moves (list, pos, ALL_MOVES);
+}
+
+int generate_capture_list (MOVE list [], POSITION *pos)
+{
+    return generate_moves (list, pos, CAPTURES);
+}
+
+int generate_quiet_list (MOVE list [], POSITION *pos)
+{
+    return generate_moves (list, pos, QUIETS);
+}
+
+// The slider attack lookups; the index into each square's table is either
+// extracted from the occupancy bits directly with PEXT or calculated with a
+// multiply and shift (both give each square 1 << bits entries).
+
+static uint64_t bishop_attacks_magic (int bit, uint64_t occupied)
+{
+    SLIDER *slider = bishop_sliders + bit;
+    return slider->attacks [((occupied & slider->mask) * slider->magic) >> slider->shift];
+}
+
+static uint64_t rook_attacks_magic (int bit, uint64_t occupied)
+{
+    SLIDER *slider = rook_sliders + bit;
+    return slider->attacks [((occupied & slider->mask) * slider->magic) >> slider->shift];
+}
+
+#ifdef USE_PEXT
+
+__attribute__ ((target ("bmi2"))) static uint64_t pext (uint64_t bits, uint64_t mask)
+{
+    return _pext_u64 (bits, mask);
+}
+
+__attribute__ ((target ("bmi2"))) static uint64_t bishop_attacks_pext (int bit, uint64_t occupied)
+{
+    return bishop_sliders [bit].attacks [_pext_u64 (occupied, bishop_sliders [bit].mask)];
+}
+
+__attribute__ ((target ("bmi2"))) static uint64_t rook_attacks_pext (int bit, uint64_t occupied)
+{
+    return rook_sliders [bit].attacks [_pext_u64 (occupied, rook_sliders [bit].mask)];
+}
+
+#endif
+
+// Calculate slider attacks the slow way (for filling in the tables). The
+// rays from "first" to "last" are followed until they hit a piece.
+
+static uint64_t slider_attacks (int bit, uint64_t occupied, int first, int last)
+{
+    uint64_t attacks = 0;
+    int dir;
+
+    for (dir = first; dir <= last; ++dir) {
+        int rank = bit >> 3, file = bit & 7;
+
+        while (1) {
+            rank += ray_ranks [dir];
+            file += ray_files [dir];
+
+            if (rank < 0 || rank >= BOARD_SIDE || file < 0 || file >= BOARD_SIDE)
+                break;
+
+            attacks |= 1ULL << (rank * 8 + file);
+
+            if ((occupied >> (rank * 8 + file)) & 1)
+                break;
+        }
+    }
+
+    return attacks;
+}
+
+// Fill in the attack table for one slider on one square. The "mask" is the
+// squares whose occupancy matters (the edge squares at the end of each ray
+// don't). Returns the table space used.
+
+static int init_slider (SLIDER *slider, uint64_t *table, int bit, int first, int last, uint64_t magic, int use_pext)
+{
+    uint64_t subset = 0;
+    int count = 0;
+
+    slider->mask = slider_attacks (bit, 0, first, last);
+
+    if ((bit >> 3) != 0) slider->mask &= ~0xffULL;
+    if ((bit >> 3) != 7) slider->mask &= ~0xff00000000000000ULL;
+    if ((bit & 7) != 0) slider->mask &= ~0x0101010101010101ULL;
+    if ((bit & 7) != 7) slider->mask &= ~0x8080808080808080ULL;
+
+    slider->shift = 64 - __builtin_popcountll (slider->mask);
+    slider->magic = magic;
+    slider->attacks = table;
+
+    // enumerate all the subsets of the mask (the "carry-rippler" trick)
+
+    do {
+#ifdef USE_PEXT
+        if (use_pext)
+            table [pext (subset, slider->mask)] = slider_attacks (bit, subset, first, last);
+        else
+#endif
+        table [(subset * magic) >> slider->shift] = slider_attacks (bit, subset, first, last);
+        subset = (subset - slider->mask) & slider->mask;
+        count++;
+    } while (subset);
+
+    return count;
+}
+
+// Initialize all the tables. Called once via pthread_once().
+
+static void init_bitboards (void)
+{
+    int rank, file, bit, dir, use_pext = FALSE, used = 0;
+
+#ifdef USE_PEXT
+    __builtin_cpu_init ();
+    use_pext = __builtin_cpu_supports ("bmi2");
+#endif
+
+    for (rank = 1; rank <= BOARD_SIDE; ++rank)
+        for (file = 1; file <= BOARD_SIDE; ++file) {
+            bit = (rank - 1) * 8 + file - 1;
+            bb_index [bit] = INDEX (rank, file);
+            bb_masks [INDEX (rank, file)] = 1ULL << bit;
+            bb_bits [INDEX (rank, file)] = bit;
+        }
+
+    for (bit = 0; bit < 64; ++bit) {
+        int index = bb_index [bit];
+
+        knight_attacks [bit] = bb_masks [index + KNIGHT1] | bb_masks [index + KNIGHT2] |
+            bb_masks [index + KNIGHT3] | bb_masks [index + KNIGHT4] | bb_masks [index + KNIGHT5] |
+            bb_masks [index + KNIGHT6] | bb_masks [index + KNIGHT7] | bb_masks [index + KNIGHT8];
+
+        king_attacks [bit] = bb_masks [index + DIAG1] | bb_masks [index + DIAG2] |
+            bb_masks [index + DIAG3] | bb_masks [index + DIAG4] | bb_masks [index + ORTHOG1] |
+            bb_masks [index + ORTHOG2] | bb_masks [index + ORTHOG3] | bb_masks [index + ORTHOG4];
+
+        pawn_attacks [0] [bit] = bb_masks [index + WPCAP1] | bb_masks [index + WPCAP2];
+        pawn_attacks [1] [bit] = bb_masks [index + BPCAP1] | bb_masks [index + BPCAP2];
+
+        for (dir = 0; dir < 8; ++dir)
+            rays [dir] [bit] = slider_attacks (bit, 0, dir, dir);
+    }
+
+    for (bit = 0; bit < 64; ++bit) {
+        used += init_slider (bishop_sliders + bit, slider_table + used, bit, 0, 3, bishop_magics [bit], use_pext);
+        used += init_slider (rook_sliders + bit, slider_table + used, bit, 4, 7, rook_magics [bit], use_pext);
+    }
+
+#ifdef USE_PEXT
+    if (use_pext) {
+        bishop_attacks = bishop_attacks_pext;
+        rook_attacks = rook_attacks_pext;
+        return;
+    }
+#endif
+
+    bishop_attacks = bishop_attacks_magic;
+    rook_attacks = rook_attacks_magic;
+}
+
+#endif
@@ -10,292 +10,2174 @@
 
 #include "fast-chess.h"
 
-static int in_check (FRAME *frame);
+struct search_team;
+
+static int in_check (POSITION *pos);
+#ifndef BITBOARDS
 static int check_attack (square *dst, int color);
-static int sum_material (FRAME *frame, int color);
-static int count_pawns (FRAME *frame, int color);
-static int count_center_pawns (FRAME *frame, int color);
-static void scramble_moves (MOVE moves [], int nmoves);
-static int position_id (FRAME *frame);
+#endif
+static void init_piece_lists (POSITION *pos);
+static int sum_material (POSITION *pos, int color);
+static int count_pawns (POSITION *pos, int color);
+static int count_center_pawns (POSITION *pos, int color);
+static int count_mobility (POSITION *pos, int color);
+static void scramble_moves (FRAME *frame, MOVE moves [], int nmoves);
+static void order_moves (FRAME *frame, MOVE moves [], int nmoves, MOVE *hashmove);
+static int add_quiet_moves (FRAME *frame, MOVE moves [], int ncaptures, MOVE *hashmove);
+static void record_cutoff (FRAME *frame, MOVE *move);
+static void age_move_tables (struct search_team *team);
+static uint64_t position_key (POSITION *pos);
+static int castle_rights (POSITION *pos);
+static void init_zobrist (void);
+static int probe_hash (FRAME *frame, MOVE *hashmove, int *score);
+static void store_hash (FRAME *frame, MOVE *bestmove, int score, int bound);
+static void *iterate_search (FRAME *frame);
+static void *search_root (FRAME *frame, int alpha, int beta);
+static void *search_position (FRAME *frame);
+static int node_beta (FRAME *frame);
+static int fails_high (FRAME *frame, int min_value);
+static int child_alpha (FRAME *frame);
+static int undecay (int flags, int value);
+static void count_nodes (FRAME *frame);
+static int hash_variation (FRAME *frame, MOVE *bestmove, MOVE pv [], int max_moves);
+static int search_move (FRAME *frame, MOVE *move, int depth, int *min_value_p, MOVE *bestmove_p, MOVE thismove, int alpha);
+static int search_node_move (FRAME *frame, MOVE *move, int mindex, int futile, int *min_value_p, MOVE *bestmove_p, MOVE thismove);
+static int evaluate (FRAME *frame);
+static void make_null_move (FRAME *frame, UNDO *undo);
+static void unmake_null_move (FRAME *frame, UNDO *undo);
+static int is_quiet (POSITION *pos, MOVE *move);
+static void *lazy_smp_search (FRAME *frame);
+static void *pool_worker (void *unused);
+static int help_split (int thread_index, struct split_point *ancestor);
+static void form_team (FRAME *frame, struct search_team *team);
+static void disband_team (struct search_team *team);
+
+static unsigned int random_seed;     // the last seed given to init_random()
+
+// Zobrist keys for the incrementally maintained 64-bit position hash; these
+// are indexed directly by board index (rather than 0-63) to avoid converting.
+
+static uint64_t zobrist_pieces [PIECE + COLOR + 1] [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
+static uint64_t zobrist_epsquare [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
+static uint64_t zobrist_castle [16], zobrist_color;
+static pthread_once_t zobrist_once = PTHREAD_ONCE_INIT;
+
+#define PIECE_KEY(piece, index) (zobrist_pieces [(piece) & (PIECE | COLOR)] [index])
+
+// With the bitboard backend, each piece is added and removed from its
+// bitboards (and the color's combined bitboard) right along with the key.
+
+#ifdef BITBOARDS
+#define BB_TOGGLE(pos, piece, index) do {                               \
+    uint64_t *bitboards = (pos)->bitboards [((piece) & COLOR) >> 3];    \
+    bitboards [(piece) & PIECE] ^= bb_masks [index];                    \
+    bitboards [0] ^= bb_masks [index];                                  \
+} while (0)
+#else
+#define BB_TOGGLE(pos, piece, index) do { } while (0)
+#endif
+
+// Each side's pieces are kept in a list, with the list slot of the piece on
+// each square in list_index [] so that it can be found directly. A captured
+// piece is replaced in its list by the last one, and unmake_move() puts it
+// back in the same slot so that the list order is exactly restored.
+
+#define LIST_MOVE(pos, piece, from, to)                                 \
+    ((pos)->piece_lists [((piece) & COLOR) >> 3]                        \
+        [(pos)->list_index [to] = (pos)->list_index [from]] = (to))
+
+#define LIST_REMOVE(pos, piece, index) do {                                    \
+    int color = ((piece) & COLOR) >> 3;                                        \
+    unsigned char *list = (pos)->piece_lists [color];                          \
+    int last = list [--(pos)->piece_counts [color]];                           \
+    list [(pos)->list_index [last] = (pos)->list_index [index]] = last;        \
+} while (0)
+
+#define LIST_RESTORE(pos, piece, index, slot) do {                             \
+    int color = ((piece) & COLOR) >> 3;                                        \
+    unsigned char *list = (pos)->piece_lists [color];                          \
+    int moved = list [slot];                                                   \
+    list [(pos)->list_index [moved] = (pos)->piece_counts [color]++] = moved;  \
+    list [(pos)->list_index [index] = (slot)] = (index);                       \
+} while (0)
+
+// Scores are kept well inside SCORE_LIMIT (mates are 10000). A node's score
+// is "decayed" toward zero each ply when EVAL_DECAY is set, so that nearer
+// mates (and gains) score higher than more distant ones.
+
+#define SCORE_LIMIT     20000
+#define DECAY(flags, min_value) \
+    (((flags) & EVAL_DECAY) ? (min_value) - (((min_value) + 128) >> 8) : (min_value))
+
+// The repetition history is a stack of keys indexed by ply (modulo its size,
+// which is enough for MAX_POS_IDS plies back from the deepest search).
+
+#define PLY(pos) ((pos)->move_number * 2 + ((pos)->move_color ? 1 : 0))
+#define HISTORY_KEY(frame, ply) ((frame)->history [(ply) & (MAX_HISTORY - 1)])
+
+// The transposition table is shared by all search threads without locking.
+// Each entry stores the key XORed with the data word so that an entry torn
+// by simultaneous writes from two threads simply fails verification. Entries
+// are grouped into buckets of 4 (one 64-byte cache line) and a new entry
+// replaces the shallowest (or oldest) entry in its bucket. A frame searches
+// the table created by init_hash_table() unless it's been given its own (see
+// new_hash_table()), and each table counts its own search generations.
+
+typedef struct { uint64_t check, data; } HASH_ENTRY;
+
+#define HASH_BUCKET     4
+#define HASH_EXACT      1
+#define HASH_LOWER      2
+#define HASH_UPPER      3
+
+#define HASH_SCORE(data)    ((int) ((data) & 0xffff) - 0x8000)
+#define HASH_DEPTH(data)    ((int) ((data) >> 16) & 0xff)
+#define HASH_BOUND(data)    ((int) ((data) >> 24) & 0x3)
+#define HASH_AGE(data)      ((int) ((data) >> 26) & 0x3f)
+#define HASH_FROM(data)     ((int) ((data) >> 32) & 0xff)
+#define HASH_DELTA(data)    (((int) ((data) >> 40) & 0xff) - 0x80)
+#define HASH_PROMO(data)    ((int) ((data) >> 48) & 0x7)
+
+struct hash_table {
+    HASH_ENTRY *entries;
+    uint64_t mask;
+    int generation;
+    void *memory;
+};
+
+static HASH_TABLE default_hash;
+
+#define FRAME_HASH(frame) ((frame)->hash_p ? (frame)->hash_p : &default_hash)
+
+// The search threads are created once at startup and wait on a condition
+// variable for something to do. That's either a job on the work queue or a
+// split point on another thread's deque (see below). A job is a set of
+// "count" work items (e.g., perft root moves) that are handed out one at a
+// time to idle workers (and to the thread that submitted the job, which helps
+// until all the items are claimed and then waits on another condition
+// variable for the last one to complete).
+
+typedef struct parallel_job {
+    void (*function) (void *context, int index);
+    int count, next, completed;
+    struct parallel_job *next_job;
+    void *context;
+} PARALLEL_JOB;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned int pool_events;
+static PARALLEL_JOB *job_queue;
+static int pool_threads, idle_threads;
+
+// The search splits at interior nodes using the "young brothers wait" idea;
+// once the first (eldest) move of a node has been searched, and if there are
+// idle threads, the rest of the moves are made available to other threads by
+// pushing a split point onto the searching thread's deque. Idle threads steal
+// the oldest (and therefore largest) split point they can find on the other
+// threads' deques and search moves from it until they run out. The owner of
+// the split point searches moves from it too, and then helps with any split
+// points below it until all the helpers are done. The threads searching a
+// split point share the node's "min_value" and flag the moves that lowered
+// it so the best move can be found at the end. Every thread searches its moves
+// with the same selective search as the serial move loop (see
+// search_node_move()). If a cutoff occurs at a split point, it's flagged as
+// aborted and all the threads working below it give up (without storing
+// anything) as soon as they notice.
+
+#define SPLIT_DEPTH     2
+#define MAX_SPLITS      64
+
+typedef struct split_point {
+    struct split_point *parent;
+    struct search_team *team;
+    FRAME *frame;
+    MOVE *moves, lowered [MAX_MOVES + 10];
+    int values [MAX_MOVES + 10];
+    int nmoves, next_move, min_value, workers, abort, pruned, futile;
+} SPLIT_POINT;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    SPLIT_POINT *splits [MAX_SPLITS];
+    int nsplits;
+} SPLIT_DEQUE;
+
+static SPLIT_DEQUE *split_deques;
+
+// Everything a search thread changes as it goes (other than the frames it's
+// searching and the shared transposition table) is kept in its own state,
+// which is selected by frame->thread_index and aligned to a cache line so
+// that nothing is shared between cores (by accident or otherwise). That's
+// the seed for scrambling the moves (see scramble_moves()), and the tables
+// of the quiet moves that caused cutoffs, which are used to order the quiet
+// moves: two "killer" moves for each ply, the move that last refuted each
+// move (by the piece moved and its destination), and a "history" score for
+// each from/to pair that goes up by the square of the remaining depth every
+// time the move causes a cutoff. The killers and refutations are cleared for
+// each new search and the history scores are halved (as they also are
+// whenever one gets too high). With SEARCH_STATS, it's also where the thread
+// keeps its counts (and when it started waiting, if it's idle). While the
+// state is being searched with it also points to the search's team (below).
+
+#define HISTORY_MAX     (1 << 24)
+
+typedef struct {
+    unsigned int random_seed;
+    MOVE killers [MAX_HISTORY] [2];
+    MOVE countermoves [PIECE + COLOR + 1] [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
+    int history [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)] [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
+    struct search_team *team;
+#ifdef SEARCH_STATS
+    SEARCH_COUNTS counts;
+    long long idle_start;
+#endif
+} THREAD_STATE;
+
+static THREAD_STATE *thread_states;
+static int num_thread_states;
+
+// Each search has a "team" of thread states: the one it was started with
+// (frame->thread_index), and for a multi-threaded search up to max_threads - 1
+// more for the threads that help it, claimed from the states that no other
+// search has when it starts. A pool thread that joins one of its split points
+// (or runs one of its lazy SMP helpers) searches with one of the team's free
+// states instead of its own, and a split is only started when there's one
+// free, so each search uses no more threads than it was given and searches
+// started with claim_thread_state() (e.g., by separate library instances) can
+// run at the same time without sharing anything but the pool.
+
+typedef struct search_team {
+    pthread_mutex_t mutex;
+    int *members, nmembers;     // thread states, the first being the search's own
+    int *helpers, nhelpers;     // the other members not being used by a helper now
+    int owner_claimed;          // TRUE if the search's own state was claimed for it here
+} SEARCH_TEAM;
+
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t state_released = PTHREAD_COND_INITIALIZER;
+static unsigned char *state_claimed;
+
+// The statements that count the search statistics are wrapped in STAT() so
+// that they disappear entirely unless SEARCH_STATS is defined.
+
+#ifdef SEARCH_STATS
+#define STAT(statement) do { if (thread_states) { statement; } } while (0)
+#define COUNTS(frame) (&thread_states [(frame)->thread_index].counts)
+
+static void begin_counts (FRAME *frame, SEARCH_TEAM *team);
+static void end_counts (FRAME *frame, SEARCH_TEAM *team);
+static void begin_idle (int thread_index);
+static void end_idle (int thread_index);
+static long long current_usecs (void);
+#else
+#define STAT(statement) do { } while (0)
+#endif
+
+#define SAME_MOVE(a, b) ((a).from == (b).from && (a).delta == (b).delta && (a).promo == (b).promo)
+
+// Create the pool of search threads; because the calling thread also works
+// on the jobs it submits, this is one fewer than the maximum thread count.
+// This should be called once at startup. Returns the number of threads that
+// can work on a job in parallel (including the caller).
+
+int init_thread_pool (int max_threads)
+{
+    pthread_t pthread;
+    int tindex;
+
+    if (max_threads < 1)
+        max_threads = 1;
+
+    split_deques = calloc (max_threads, sizeof (SPLIT_DEQUE));
+    thread_states = calloc (1, max_threads * sizeof (THREAD_STATE) + 63);
+    thread_states = (THREAD_STATE *) (((uintptr_t) thread_states + 63) & ~(uintptr_t) 63);
+    num_thread_states = max_threads;
+    state_claimed = calloc (max_threads, 1);
+    init_random (random_seed);
+
+    for (tindex = 0; tindex < max_threads; ++tindex)
+        pthread_mutex_init (&split_deques [tindex].mutex, NULL);
+
+    while (pool_threads < max_threads - 1 &&
+        !pthread_create (&pthread, NULL, pool_worker, NULL)) {
+            pthread_detach (pthread);
+            pool_threads++;
+    }
+
+    return pool_threads + 1;
+}
 
-static unsigned int random_seed;
+// Claim a thread state that no other search is using (waiting until there is
+// one) and return its index, for a search to be started with it as the frame's
+// thread_index. It's released again with release_thread_state(). Searches given
+// thread indices some other way (like the run_parallel() items below) must not
+// run at the same time as searches that claim them.
 
-void init_random (unsigned int seed)
+int claim_thread_state (void)
+{
+    int tindex = 0;
+
+    pthread_mutex_lock (&state_mutex);
+
+    while (1) {
+        for (tindex = 0; tindex < num_thread_states; ++tindex)
+            if (!state_claimed [tindex])
+                break;
+
+        if (tindex < num_thread_states || !num_thread_states)
+            break;
+
+        pthread_cond_wait (&state_released, &state_mutex);
+    }
+
+    if (tindex < num_thread_states)
+        state_claimed [tindex] = 1;
+
+    pthread_mutex_unlock (&state_mutex);
+    return tindex;
+}
+
+void release_thread_state (int thread_index)
+{
+    pthread_mutex_lock (&state_mutex);
+
+    if (thread_index < num_thread_states)
+        state_claimed [thread_index] = 0;
+
+    pthread_cond_broadcast (&state_released);
+    pthread_mutex_unlock (&state_mutex);
+}
+
+// Form the team of thread states for the specified frame's search (see above);
+// the helpers' states are only the ones free right now, so this never waits.
+
+static void form_team (FRAME *frame, SEARCH_TEAM *team)
+{
+    int wanted = frame->max_threads > 1 ? frame->max_threads : 1, tindex;
+
+    pthread_mutex_init (&team->mutex, NULL);
+    team->members = malloc (wanted * 2 * sizeof (int));
+    team->helpers = team->members + wanted;
+    team->members [0] = frame->thread_index;
+    team->nmembers = 1;
+    team->nhelpers = 0;
+    team->owner_claimed = FALSE;
+
+    if (!thread_states || frame->thread_index >= num_thread_states)
+        return;
+
+    pthread_mutex_lock (&state_mutex);
+
+    if (!state_claimed [frame->thread_index])
+        team->owner_claimed = state_claimed [frame->thread_index] = 1;
+
+    for (tindex = 0; tindex < num_thread_states && team->nmembers < wanted; ++tindex)
+        if (!state_claimed [tindex]) {
+            state_claimed [tindex] = 1;
+            team->members [team->nmembers++] = team->helpers [team->nhelpers++] = tindex;
+        }
+
+    pthread_mutex_unlock (&state_mutex);
+
+    for (tindex = 0; tindex < team->nmembers; ++tindex)
+        thread_states [team->members [tindex]].team = team;
+}
+
+static void disband_team (SEARCH_TEAM *team)
+{
+    int mindex;
+
+    if (thread_states && team->members [0] < num_thread_states) {
+        pthread_mutex_lock (&state_mutex);
+
+        for (mindex = 0; mindex < team->nmembers; ++mindex) {
+            thread_states [team->members [mindex]].team = NULL;
+
+            if (mindex || team->owner_claimed)
+                state_claimed [team->members [mindex]] = 0;
+        }
+
+        pthread_cond_broadcast (&state_released);
+        pthread_mutex_unlock (&state_mutex);
+    }
+
+    pthread_mutex_destroy (&team->mutex);
+    free (team->members);
+}
+
+// Take a free helper state from the specified team (returning its index, or
+// -1 if there isn't one), and give it back. With SEARCH_STATS, a helper state
+// is idle while it's free (a pool thread that's waiting isn't working for
+// any search, so its own waiting isn't counted anywhere).
+
+static int take_helper (SEARCH_TEAM *team)
+{
+    int tindex = -1;
+
+    if (!team || !__atomic_load_n (&team->nhelpers, __ATOMIC_RELAXED))
+        return -1;
+
+    pthread_mutex_lock (&team->mutex);
+
+    if (team->nhelpers) {
+        tindex = team->helpers [--team->nhelpers];
+        STAT (end_idle (tindex));
+    }
+
+    pthread_mutex_unlock (&team->mutex);
+    return tindex;
+}
+
+static void return_helper (SEARCH_TEAM *team, int tindex)
+{
+    pthread_mutex_lock (&team->mutex);
+    STAT (begin_idle (tindex));
+    team->helpers [team->nhelpers++] = tindex;
+    pthread_mutex_unlock (&team->mutex);
+}
+
+// Wake all the waiting threads because new work is available (or because a
+// thread has finished helping at a split point).
+
+static void signal_pool (void)
+{
+    pthread_mutex_lock (&pool_mutex);
+    pool_events++;
+    pthread_cond_broadcast (&pool_work);
+    pthread_mutex_unlock (&pool_mutex);
+}
+
+// Take the next work item from the specified queued job, removing the job
+// from the queue once all its items have been handed out. Must be called
+// with the pool mutex held.
+
+static int next_work_item (PARALLEL_JOB *job)
+{
+    int index = job->next++;
+
+    if (job->next == job->count) {
+        PARALLEL_JOB **jobp = &job_queue;
+
+        while (*jobp != job)
+            jobp = &(*jobp)->next_job;
+
+        *jobp = job->next_job;
+    }
+
+    return index;
+}
+
+static void *pool_worker (void *unused)
+{
+    (void) unused;
+    pthread_mutex_lock (&pool_mutex);
+
+    while (1) {
+        PARALLEL_JOB *job = job_queue;
+        unsigned int events = pool_events;
+        int index, helped;
+
+        if (job) {
+            index = next_work_item (job);
+            pthread_mutex_unlock (&pool_mutex);
+            job->function (job->context, index);
+            pthread_mutex_lock (&pool_mutex);
+
+            if (++job->completed == job->count)
+                pthread_cond_broadcast (&pool_done);
+
+            continue;
+        }
+
+        pthread_mutex_unlock (&pool_mutex);
+        helped = help_split (-1, NULL);
+        pthread_mutex_lock (&pool_mutex);
+
+        if (!helped && !job_queue && pool_events == events) {
+            idle_threads++;
+            pthread_cond_wait (&pool_work, &pool_mutex);
+            idle_threads--;
+        }
+    }
+
+    return NULL;
+}
+
+// Call function (context, index) for each index from 0 to count-1, using the
+// thread pool to run them in parallel, and return when they are all done.
+// Each index is only run once, so if the count is no more than the thread
+// count returned by init_thread_pool(), each call can do single-threaded
+// searches with its index as the frame's thread_index (and therefore with
+// its own move tables) while the others do the same.
+
+void run_parallel (void (*function) (void *context, int index), void *context, int count)
+{
+    PARALLEL_JOB job, **jobp = &job_queue;
+
+    if (!pool_threads || count < 2) {
+        for (job.next = 0; job.next < count; ++job.next)
+            function (context, job.next);
+
+        return;
+    }
+
+    job.function = function;
+    job.context = context;
+    job.count = count;
+    job.next = job.completed = 0;
+    job.next_job = NULL;
+
+    pthread_mutex_lock (&pool_mutex);
+
+    while (*jobp)
+        jobp = &(*jobp)->next_job;
+
+    *jobp = &job;
+    pthread_cond_broadcast (&pool_work);
+
+    while (job.next < job.count) {
+        int index = next_work_item (&job);
+
+        pthread_mutex_unlock (&pool_mutex);
+        function (context, index);
+        pthread_mutex_lock (&pool_mutex);
+        job.completed++;
+    }
+
+    while (job.completed < job.count)
+        pthread_cond_wait (&pool_done, &pool_mutex);
+
+    pthread_mutex_unlock (&pool_mutex);
+}
+
+// Return TRUE if the specified split point (or any split point above it) has
+// been aborted, in which case any search below it is meaningless.
+
+static int split_aborted (SPLIT_POINT *split)
+{
+    for (; split; split = split->parent)
+        if (__atomic_load_n (&split->abort, __ATOMIC_RELAXED))
+            return TRUE;
+
+    return FALSE;
+}
+
+// Return TRUE if the search has been stopped, either because a split point
+// was aborted (see above) or because a search limit was reached.
+
+static int search_aborted (SPLIT_POINT *split, SEARCH_LIMITS *limits)
+{
+    return split_aborted (split) || (limits && __atomic_load_n (&limits->stop, __ATOMIC_RELAXED));
+}
+
+// Return TRUE if a split should be started at the specified node, which is
+// only when there's an idle thread to help, a free state in the search's team
+// for it to help with (see above), and room on our deque.
+
+static int can_split (FRAME *frame)
+{
+    SEARCH_TEAM *team;
+
+    if (frame->max_threads < 2 || frame->depth < SPLIT_DEPTH ||
+        !__atomic_load_n (&idle_threads, __ATOMIC_RELAXED) ||
+        split_deques [frame->thread_index].nsplits >= MAX_SPLITS)
+            return FALSE;
+
+    team = thread_states [frame->thread_index].team;
+    return team && __atomic_load_n (&team->nhelpers, __ATOMIC_RELAXED);
+}
+
+// Give the specified frame (a copy being handed to another thread) its own
+// repetition history stack, copying over just the keys that can still be
+// repeated. The keys are left in place at the same plies.
+
+static void fork_history (FRAME *frame, uint64_t history [])
+{
+    int ply = PLY (&frame->pos), count = frame->pos.reversable_moves;
+
+    if (count >= MAX_POS_IDS)
+        count = 0;
+
+    for (; count >= 0; --count, --ply)
+        history [ply & (MAX_HISTORY - 1)] = HISTORY_KEY (frame, ply);
+
+    frame->history = history;
+}
+
+// Search moves from the specified split point until they run out (or there's
+// a cutoff, or a split point above us is aborted). This is done by both the
+// owner of the split point and the threads that steal it.
+
+static void search_split (SPLIT_POINT *split, int thread_index)
+{
+    FRAME *frame = split->frame, temp = *frame;
+    uint64_t history [MAX_HISTORY];
+    int mindex;
+
+    if (thread_index != frame->thread_index)
+        fork_history (&temp, history);
+
+    temp.thread_index = thread_index;
+    temp.split_p = split;
+    temp.node_count = 0;
+
+    while (!search_aborted (split, frame->limits_p)) {
+        if ((frame->flags & EVAL_PRUNE) && fails_high (frame, __atomic_load_n (&split->min_value, __ATOMIC_RELAXED))) {
+            split->pruned = TRUE;
+            __atomic_store_n (&split->abort, TRUE, __ATOMIC_RELAXED);
+            break;
+        }
+
+        if ((mindex = __atomic_fetch_add (&split->next_move, 1, __ATOMIC_RELAXED)) >= split->nmoves)
+            break;
+
+        split->values [mindex] = search_node_move (&temp, split->moves + mindex, mindex, split->futile,
+            &split->min_value, split->lowered + mindex, split->moves [mindex]);
+    }
+
+    if (temp.limits_p)
+        count_nodes (&temp);
+}
+
+// Look for a split point with moves left on the other threads' deques (oldest
+// first) and help search it. If "ancestor" is specified, only split points
+// below it are considered (this is how the owner of a split point helps its
+// helpers while it waits for them to finish) and we search with our own
+// thread state. Otherwise we're an idle pool thread (with a thread_index of
+// -1) and only join split points whose team has a free state for us to use.
+// Returns TRUE if we helped.
+
+static int help_split (int thread_index, SPLIT_POINT *ancestor)
+{
+    int tindex, sindex, helper = thread_index;
+
+    for (tindex = 0; tindex < num_thread_states; ++tindex) {
+        SPLIT_DEQUE *deque = split_deques + tindex;
+        SPLIT_POINT *split = NULL;
+
+        if (tindex == thread_index || !__atomic_load_n (&deque->nsplits, __ATOMIC_RELAXED))
+            continue;
+
+        pthread_mutex_lock (&deque->mutex);
+
+        for (sindex = 0; sindex < deque->nsplits; ++sindex) {
+            SPLIT_POINT *parent = deque->splits [sindex];
+
+            if (__atomic_load_n (&parent->next_move, __ATOMIC_RELAXED) >= parent->nmoves ||
+                __atomic_load_n (&parent->abort, __ATOMIC_RELAXED))
+                    continue;
+
+            if (ancestor)
+                while (parent && parent != ancestor)
+                    parent = parent->parent;
+
+            if (parent && (ancestor || (helper = take_helper (deque->splits [sindex]->team)) >= 0)) {
+                split = deque->splits [sindex];
+                __atomic_fetch_add (&split->workers, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+
+        pthread_mutex_unlock (&deque->mutex);
+
+        if (split) {
+            STAT (thread_states [helper].counts.helps++);
+            search_split (split, helper);
+
+            if (!ancestor)
+                return_helper (split->team, helper);
+
+            __atomic_fetch_sub (&split->workers, 1, __ATOMIC_RELEASE);
+            signal_pool ();
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// Split the search of the specified node, starting with move "first" (the
+// moves before that having already been searched, and "futile" saying whether
+// its quiet moves can be skipped). The node's min_value, bestindex and pruned
+// status are updated with the results.
+
+static void split_node (FRAME *frame, MOVE moves [], int first, int nmoves, int futile, int *min_value, int *bestindex, int *pruned)
+{
+    SPLIT_DEQUE *deque = split_deques + frame->thread_index;
+    SPLIT_POINT split;
+    int mindex;
+
+    split.parent = frame->split_p;
+    split.team = thread_states [frame->thread_index].team;
+    split.frame = frame;
+    split.moves = moves;
+    split.nmoves = nmoves;
+    split.next_move = first;
+    split.min_value = *min_value;
+    split.workers = split.abort = split.pruned = 0;
+    split.futile = futile;
+
+    for (mindex = first; mindex < nmoves; ++mindex)
+        split.lowered [mindex].from = 0;
+
+    pthread_mutex_lock (&deque->mutex);
+    deque->splits [deque->nsplits++] = &split;
+    pthread_mutex_unlock (&deque->mutex);
+    STAT (COUNTS (frame)->splits++);
+    signal_pool ();
+
+    search_split (&split, frame->thread_index);
+
+    pthread_mutex_lock (&deque->mutex);
+    deque->nsplits--;
+    pthread_mutex_unlock (&deque->mutex);
+
+    while (1) {
+        unsigned int events = __atomic_load_n (&pool_events, __ATOMIC_ACQUIRE);
+
+        if (!__atomic_load_n (&split.workers, __ATOMIC_ACQUIRE))
+            break;
+
+        if (help_split (frame->thread_index, &split))
+            continue;
+
+        pthread_mutex_lock (&pool_mutex);
+        STAT (begin_idle (frame->thread_index));
+
+        while (pool_events == events)
+            pthread_cond_wait (&pool_work, &pool_mutex);
+
+        STAT (end_idle (frame->thread_index));
+        pthread_mutex_unlock (&pool_mutex);
+    }
+
+    // the best move is the one whose score last lowered the shared bound
+
+    for (mindex = first; mindex < nmoves; ++mindex)
+        if (split.lowered [mindex].from && split.values [mindex] == split.min_value) {
+            *bestindex = mindex;
+            break;
+        }
+
+    *min_value = split.min_value;
+    *pruned = split.pruned;
+}
+
+// In lazy SMP mode there's no splitting; instead every thread searches the
+// root, single-threaded, and they share results only through the hash table.
+// The first work item is the "main" search that provides the result, while
+// the helpers search at alternating extra depth and keep going deeper until
+// the main search is done, at which point the split point (which is used here
+// just for its abort flag) makes them give up. Note that the helpers always
+// scramble moves that order the same so that they don't all follow each other.
+// There's one work item for each member of the search's team, and each one
+// searches with that member's thread state (so a helper state is only idle
+// until a pool thread picks up its item).
+
+typedef struct {
+    FRAME *frame;
+    SPLIT_POINT stop;
+    SEARCH_TEAM *team;
+    int score;
+} LAZY_SMP;
+
+static void lazy_smp_job (void *context, int index)
+{
+    LAZY_SMP *lazy = (LAZY_SMP *) context;
+    FRAME temp = *lazy->frame;
+    uint64_t history [MAX_HISTORY];
+
+    temp.flags &= ~EVAL_LAZY_SMP;
+    temp.max_threads = 1;
+    temp.node_count = 0;
+
+    if (!index) {
+        lazy->score = (int) (long) search_position (&temp);
+        __atomic_store_n (&lazy->stop.abort, TRUE, __ATOMIC_RELAXED);
+
+        if (temp.limits_p)
+            count_nodes (&temp);
+
+        return;
+    }
+
+    fork_history (&temp, history);
+
+    if (lazy->team) {
+        temp.thread_index = lazy->team->members [index];
+        STAT (end_idle (temp.thread_index));
+    }
+
+    temp.flags |= EVAL_INTERNAL | EVAL_SCRAMBLE;
+    temp.depth += index & 1;
+    temp.split_p = &lazy->stop;
+    temp.bestmove_p = NULL;
+
+    while (!__atomic_load_n (&lazy->stop.abort, __ATOMIC_RELAXED) && temp.depth < MAX_DEPTH) {
+        FRAME helper = temp;
+
+        search_position (&helper);
+        temp.node_count = helper.node_count;
+        temp.depth++;
+    }
+
+    if (lazy->team)
+        STAT (begin_idle (temp.thread_index));
+
+    if (temp.limits_p)
+        count_nodes (&temp);
+}
+
+static void *lazy_smp_search (FRAME *frame)
+{
+    LAZY_SMP lazy;
+
+    lazy.frame = frame;
+    lazy.stop.parent = NULL;
+    lazy.stop.abort = FALSE;
+    lazy.team = thread_states ? thread_states [frame->thread_index].team : NULL;
+    run_parallel (lazy_smp_job, &lazy, lazy.team ? lazy.team->nmembers : frame->max_threads);
+    return (void *) (long) lazy.score;
+}
+
+// Evaluate a stream of positions in parallel, with each thread of the pool
+// searching one position at a time (by itself, using its own move tables).
+// The "next" function sets up the frame for the next position (its history
+// stack is already provided) and returns FALSE when there are no more, and
+// "done" is called with the frame, the order in which it was set up, and its
+// score once it's been searched (the best move is at frame->bestmove_p). The
+// frame's search limits (if any) are copied, so they can be shared, and the
+// search count is left in the copy. Both functions are called with a mutex
+// held, so they needn't be thread-safe. The results come back in the order
+// the searches finish, which isn't necessarily the order they were set up.
+
+typedef struct {
+    int (*next) (void *context, FRAME *frame);
+    void (*done) (void *context, int index, FRAME *frame, int score);
+    pthread_mutex_t mutex;
+    int count;
+    void *context;
+} BATCH_JOB;
+
+static void batch_job (void *context, int index)
+{
+    BATCH_JOB *batch = (BATCH_JOB *) context;
+    uint64_t history [MAX_HISTORY];
+    SEARCH_LIMITS limits;
+    MOVE bestmove;
+    FRAME frame;
+
+    while (1) {
+        int score, order;
+
+        init_frame (&frame, history);
+        pthread_mutex_lock (&batch->mutex);
+
+        if (!batch->next (batch->context, &frame)) {
+            pthread_mutex_unlock (&batch->mutex);
+            break;
+        }
+
+        order = batch->count++;
+        pthread_mutex_unlock (&batch->mutex);
+
+        if (frame.limits_p) {
+            limits = *frame.limits_p;
+            frame.limits_p = &limits;
+        }
+
+        frame.flags &= ~EVAL_INTERNAL;
+        frame.max_threads = 1;
+        frame.thread_index = index;
+        frame.bestmove_p = &bestmove;
+        bestmove.from = 0;
+        score = (int) (long) eval_position (&frame);
+
+        pthread_mutex_lock (&batch->mutex);
+        batch->done (batch->context, order, &frame, score);
+        pthread_mutex_unlock (&batch->mutex);
+    }
+}
+
+void eval_positions (int max_threads, int (*next) (void *context, FRAME *frame),
+    void (*done) (void *context, int index, FRAME *frame, int score), void *context)
+{
+    BATCH_JOB batch;
+
+    batch.next = next;
+    batch.done = done;
+    batch.context = context;
+    batch.count = 0;
+    pthread_mutex_init (&batch.mutex, NULL);
+
+    if (max_threads > num_thread_states)
+        max_threads = num_thread_states;
+
+    run_parallel (batch_job, &batch, max_threads > 1 ? max_threads : 1);
+    pthread_mutex_destroy (&batch.mutex);
+}
+
+// Allocate the entries of a transposition table, using the largest power-of-
+// two number of buckets that fits in the specified size (replacing any it
+// already had); a size of 0 leaves it with none (i.e., disabled). Returns
+// FALSE if the memory could not be allocated.
+
+static int alloc_hash_entries (HASH_TABLE *table, int megabytes)
+{
+    size_t buckets = 1, bytes = (size_t) megabytes << 20;
+
+    free (table->memory);
+    table->memory = table->entries = NULL;
+    table->mask = 0;
+
+    if (bytes < HASH_BUCKET * sizeof (HASH_ENTRY))
+        return TRUE;
+
+    while (buckets * 2 * HASH_BUCKET * sizeof (HASH_ENTRY) <= bytes)
+        buckets *= 2;
+
+    if (!(table->memory = malloc (buckets * HASH_BUCKET * sizeof (HASH_ENTRY) + 63)))
+        return FALSE;
+
+    table->entries = (HASH_ENTRY *) (((uintptr_t) table->memory + 63) & ~(uintptr_t) 63);
+    memset (table->entries, 0, buckets * HASH_BUCKET * sizeof (HASH_ENTRY));
+    table->mask = buckets - 1;
+    return TRUE;
+}
+
+// Allocate the transposition table that frames use by default. It's called
+// at startup, and may be called again to resize (and clear) the table when
+// nothing is being searched; a size of 0 disables the table. Returns FALSE
+// if the memory could not be allocated.
+
+int init_hash_table (int megabytes)
+{
+    return alloc_hash_entries (&default_hash, megabytes);
+}
+
+// Create a separate transposition table (for frame->hash_p), so that searches
+// that have nothing to do with each other don't compete for entries; a size
+// of 0 creates a table that stores nothing. Returns NULL if the memory could
+// not be allocated. It must not be freed while any frame is searching it.
+
+HASH_TABLE *new_hash_table (int megabytes)
+{
+    HASH_TABLE *table = calloc (1, sizeof (HASH_TABLE));
+
+    if (table && !alloc_hash_entries (table, megabytes)) {
+        free (table);
+        return NULL;
+    }
+
+    return table;
+}
+
+void free_hash_table (HASH_TABLE *table)
 {
-    int c = 10;
+    if (table) {
+        free (table->memory);
+        free (table);
+    }
+}
 
-    while (c--)
-        seed = ((seed << 4) - seed) ^ 1;
+// Seed the random move scrambling (EVAL_SCRAMBLE) of every search thread,
+// each with its own sequence. This can be called before the thread pool is
+// created (which applies the last seed given, or 0) but must not be called
+// while anything is being searched.
+
+void init_random (unsigned int seed)
+{
+    int tindex, c;
 
     random_seed = seed;
+
+    for (tindex = 0; tindex < num_thread_states; ++tindex) {
+        unsigned int state = seed + tindex * 2654435761U;
+
+        for (c = 10; c--;)
+            state = ((state << 4) - state) ^ 1;
+
+        thread_states [tindex].random_seed = state;
+    }
 }
 
-void init_frame (FRAME *frame)
+void init_frame (FRAME *frame, uint64_t history [])
 {
     int initial_lineup [] = {
         ROOK, KNIGHT, BISHOP, QUEEN, KING, BISHOP, KNIGHT, ROOK };
 
+    POSITION *pos = &frame->pos;
     int rank, file;
 
-    memset (frame->board, BORDER, sizeof (frame->board));
+    pthread_once (&zobrist_once, init_zobrist);
+    memset (pos->board, BORDER, sizeof (pos->board));
 
     for (rank = 1; rank <= BOARD_SIDE; ++rank)
         for (file = 1; file <= BOARD_SIDE; ++file)
-            SQUARE (frame, rank, file) = 0;
+            SQUARE (pos, rank, file) = 0;
 
     for (file = 1; file <= BOARD_SIDE; ++file) {
 
-        SQUARE (frame, 1, file) = SQUARE (frame, BOARD_SIDE, file) =
+        SQUARE (pos, 1, file) = SQUARE (pos, BOARD_SIDE, file) =
                 initial_lineup [file - 1];
 
-        SQUARE (frame, 2, file) = SQUARE (frame, BOARD_SIDE - 1, file) = PAWN;
+        SQUARE (pos, 2, file) = SQUARE (pos, BOARD_SIDE - 1, file) = PAWN;
     }
 
     for (rank = 1; rank <= BOARD_SIDE; ++rank)
         for (file = 1; file <= BOARD_SIDE; ++file)
-            if (SQUARE (frame, rank, file)) {
+            if (SQUARE (pos, rank, file)) {
 
                 if (rank > BOARD_SIDE / 2)
-                    SQUARE (frame, rank, file) |= COLOR;
+                    SQUARE (pos, rank, file) |= COLOR;
 
-                if ((SQUARE (frame, rank, file) & PIECE) == KING) {
+                if ((SQUARE (pos, rank, file) & PIECE) == KING) {
 
-                    if (SQUARE (frame, rank, file) & COLOR)
-                        frame->black_king = INDEX (rank, file);
+                    if (SQUARE (pos, rank, file) & COLOR)
+                        pos->black_king = INDEX (rank, file);
                     else
-                        frame->white_king = INDEX (rank, file);
+                        pos->white_king = INDEX (rank, file);
                 }
             }
 
-    frame->drawn_game = frame->white_epsquare = frame->black_epsquare = 0;
-    frame->reversable_moves = frame->move_color = 0;
-    frame->move_number = 1;
+    pos->drawn_game = pos->white_epsquare = pos->black_epsquare = 0;
+    pos->reversable_moves = pos->move_color = 0;
+    pos->move_number = 1;
+
+    init_piece_lists (pos);
+#ifdef BITBOARDS
+    bb_setup (pos);
+#endif
 
-    frame->in_check = in_check (frame);
-    frame->position_ids [frame->reversable_moves] = position_id (frame);
-    frame->black_material = sum_material (frame, COLOR);
-    frame->white_material = sum_material (frame, 0);
-    frame->black_pawns = count_pawns (frame, COLOR);
-    frame->white_pawns = count_pawns (frame, 0);
+    pos->in_check = in_check (pos);
+    pos->key = position_key (pos);
+    pos->black_material = sum_material (pos, COLOR);
+    pos->white_material = sum_material (pos, 0);
+    pos->black_pawns = count_pawns (pos, COLOR);
+    pos->white_pawns = count_pawns (pos, 0);
+
+    frame->history = history;
+    HISTORY_KEY (frame, PLY (pos)) = pos->key;
     frame->num_cap_pos = 0;
+    frame->limits_p = NULL;
+    frame->hash_p = NULL;
+#ifdef SEARCH_STATS
+    frame->counts_p = NULL;
+#endif
+    frame->node_count = 0;
+    frame->last_to = 0;
+    frame->thread_index = 0;
 }
 
-void *eval_position (void *threadid)
+// Set up the specified frame for the position given in Forsyth-Edwards
+// Notation (FEN). Castling rights are represented by the king and rook not
+// having moved (every other piece is marked as moved) and the en passant
+// target by the epsquare of the pawn that just moved two squares. The move
+// counters are optional (defaulting to 0 and 1, respectively, so a FEN with
+// only the halfmove clock is accepted) and the repetition history is
+// cleared. If the FEN is not valid (or not a legal position) the frame is
+// set up for the start of a game instead and FALSE is returned.
+
+int init_frame_fen (FRAME *frame, uint64_t history [], const char *fen)
+{
+    static const char piece_chars [] = "..pknbrq";     // indexed by piece value
+    int rank = BOARD_SIDE, file = 1, counts [2] = { 0, 0 }, kings [2] = { 0, 0 };
+    POSITION *pos = &frame->pos;
+    const char *cptr;
+    char *end;
+
+    init_frame (frame, history);
+
+    for (rank = 1; rank <= BOARD_SIDE; ++rank)
+        for (file = 1; file <= BOARD_SIDE; ++file)
+            SQUARE (pos, rank, file) = 0;
+
+    rank = BOARD_SIDE;
+    file = 1;
+
+    while (*fen == ' ') fen++;
+
+    for (; *fen && *fen != ' '; ++fen)
+        if (*fen == '/') {
+            if (file != BOARD_SIDE + 1 || --rank < 1)
+                goto bad_fen;
+
+            file = 1;
+        }
+        else if (*fen >= '1' && *fen <= '8') {
+            if ((file += *fen - '0') > BOARD_SIDE + 1)
+                goto bad_fen;
+        }
+        else if (isalpha (*fen) && (cptr = strchr (piece_chars + 2, tolower (*fen)))) {
+            int piece = (int) (cptr - piece_chars), color = islower (*fen) ? 1 : 0;
+
+            if (file > BOARD_SIDE || ++counts [color] > 16 ||
+                (piece == PAWN && (rank == 1 || rank == BOARD_SIDE)) ||
+                (piece == KING && kings [color]++))
+                    goto bad_fen;
+
+            if (piece == KING) {
+                if (color)
+                    pos->black_king = INDEX (rank, file);
+                else
+                    pos->white_king = INDEX (rank, file);
+            }
+
+            SQUARE (pos, rank, file++) = piece | (color ? COLOR : 0) | MOVED;
+        }
+        else
+            goto bad_fen;
+
+    if (rank != 1 || file != BOARD_SIDE + 1 || !kings [0] || !kings [1])
+        goto bad_fen;
+
+    while (*fen == ' ') fen++;
+
+    if (*fen == 'b')
+        pos->move_color = COLOR;
+    else if (*fen != 'w')
+        goto bad_fen;
+
+    for (fen++; *fen == ' '; fen++);
+
+    // for each castling right, the king and rook (if they're there) are unmoved
+
+    for (; *fen && *fen != ' '; ++fen) {
+        int back_rank = isupper (*fen) ? 1 : BOARD_SIDE, rook_file;
+
+        if (*fen == '-')
+            continue;
+        else if (toupper (*fen) == 'K')
+            rook_file = BOARD_SIDE;
+        else if (toupper (*fen) == 'Q')
+            rook_file = 1;
+        else
+            goto bad_fen;
+
+        if ((SQUARE (pos, back_rank, 5) & PIECE) == KING && (SQUARE (pos, back_rank, rook_file) & PIECE) == ROOK) {
+            SQUARE (pos, back_rank, 5) &= ~MOVED;
+            SQUARE (pos, back_rank, rook_file) &= ~MOVED;
+        }
+    }
+
+    while (*fen == ' ') fen++;
+
+    if (*fen >= 'a' && *fen <= 'h' && (fen [1] == '3' || fen [1] == '6')) {
+        file = *fen - 'a' + 1;
+
+        if (fen [1] == '3' && pos->move_color && SQUARE (pos, 4, file) == (PAWN | MOVED))
+            pos->white_epsquare = INDEX (4, file);
+        else if (fen [1] == '6' && !pos->move_color && SQUARE (pos, 5, file) == (PAWN | COLOR | MOVED))
+            pos->black_epsquare = INDEX (5, file);
+
+        fen += 2;
+    }
+    else if (*fen == '-')
+        fen++;
+    else if (*fen)
+        goto bad_fen;
+
+    pos->reversable_moves = (short) strtol (fen, &end, 10);
+
+    if (end != fen) {
+        pos->move_number = (short) strtol (fen = end, &end, 10);
+
+        if (end == fen)
+            pos->move_number = 1;
+
+        if (pos->reversable_moves < 0 || pos->move_number < 1)
+            goto bad_fen;
+    }
+    else
+        pos->reversable_moves = 0;
+
+    init_piece_lists (pos);
+#ifdef BITBOARDS
+    bb_setup (pos);
+#endif
+
+    // the side that just moved can't be left in check
+
+    pos->move_color ^= COLOR;
+    pos->in_check = in_check (pos);
+    pos->move_color ^= COLOR;
+
+    if (pos->in_check)
+        goto bad_fen;
+
+    pos->in_check = in_check (pos);
+    pos->key = position_key (pos);
+    pos->black_material = sum_material (pos, COLOR);
+    pos->white_material = sum_material (pos, 0);
+    pos->black_pawns = count_pawns (pos, COLOR);
+    pos->white_pawns = count_pawns (pos, 0);
+
+    if (pos->reversable_moves >= MAX_POS_IDS && (!pos->in_check || generate_move_list (NULL, pos)))
+        pos->drawn_game = MOVES_OVER_50;
+
+    if (!pos->white_pawns && pos->white_material < 5 &&
+        !pos->black_pawns && pos->black_material < 5)
+            pos->drawn_game = NO_MATE_POWER;
+
+    memset (history, 0, sizeof (uint64_t) * MAX_HISTORY);
+    HISTORY_KEY (frame, PLY (pos)) = pos->key;
+    return TRUE;
+
+bad_fen:
+    init_frame (frame, history);
+    return FALSE;
+}
+
+// Write the position of the specified frame in Forsyth-Edwards Notation (the
+// reverse of init_frame_fen(), above) to "fen", which must have room for at
+// least MAX_FEN characters. Returns "fen".
+
+char *frame_fen (FRAME *frame, char *fen)
+{
+    static const char piece_chars [] = "..pknbrq";
+    POSITION *pos = &frame->pos;
+    int rank, file, rights = castle_rights (pos), empty;
+    char *cptr = fen;
+
+    for (rank = BOARD_SIDE; rank; --rank) {
+        for (empty = 0, file = 1; file <= BOARD_SIDE; ++file)
+            if (SQUARE (pos, rank, file) & PIECE) {
+                int piece = SQUARE (pos, rank, file);
+
+                if (empty)
+                    *cptr++ = '0' + empty;
+
+                *cptr++ = (piece & COLOR) ? piece_chars [piece & PIECE] : toupper (piece_chars [piece & PIECE]);
+                empty = 0;
+            }
+            else
+                empty++;
+
+        if (empty)
+            *cptr++ = '0' + empty;
+
+        if (rank > 1)
+            *cptr++ = '/';
+    }
+
+    *cptr++ = ' ';
+    *cptr++ = pos->move_color ? 'b' : 'w';
+    *cptr++ = ' ';
+
+    if (rights & 1) *cptr++ = 'K';
+    if (rights & 2) *cptr++ = 'Q';
+    if (rights & 4) *cptr++ = 'k';
+    if (rights & 8) *cptr++ = 'q';
+    if (!rights) *cptr++ = '-';
+
+    *cptr++ = ' ';
+
+    if (pos->move_color && pos->white_epsquare) {
+        *cptr++ = pos->white_epsquare % (BOARD_SIDE + 4) - 2 + 'a';
+        *cptr++ = '3';
+    }
+    else if (!pos->move_color && pos->black_epsquare) {
+        *cptr++ = pos->black_epsquare % (BOARD_SIDE + 4) - 2 + 'a';
+        *cptr++ = '6';
+    }
+    else
+        *cptr++ = '-';
+
+    sprintf (cptr, " %d %d", pos->reversable_moves, pos->move_number);
+    return fen;
+}
+
+// Write the specified move to "string" in long algebraic notation, the same
+// as UCI (e.g., "e2e4", "e1g1" for castling, "e7e8q" for promotion), which
+// must have room for at least 6 characters, and return it.
+
+char *move_string (MOVE *move, char *string)
+{
+    int from = move->from, to = move->from + move->delta;
+    char *pnames = "  pknbrq";
+
+    string [0] = from % (BOARD_SIDE + 4) - 2 + 'a';
+    string [1] = from / (BOARD_SIDE + 4) - 1 + '0';
+    string [2] = to % (BOARD_SIDE + 4) - 2 + 'a';
+    string [3] = to / (BOARD_SIDE + 4) - 1 + '0';
+    string [4] = move->promo ? pnames [move->promo] : '\0';
+    string [5] = '\0';
+    return string;
+}
+
+// Evaluate the specified position by searching it to frame->depth, returning
+// the score from the perspective of the side to move and, if bestmove_p is
+// not NULL, the best move found. If the frame has search limits, the search
+// is iterative instead (see iterate_search()).
+
+void *eval_position (void *threadid)
+{
+    FRAME *frame = (FRAME *) threadid;
+
+    if (!(frame->flags & EVAL_INTERNAL)) {
+        SEARCH_TEAM team;
+        void *result;
+
+        if (frame->depth < 0) {
+            fprintf (stderr, "calling eval_position() with depth = %d!\n", frame->depth);
+            exit (1);
+        }
+
+        __atomic_add_fetch (&FRAME_HASH (frame)->generation, 1, __ATOMIC_RELAXED);
+        form_team (frame, &team);
+        age_move_tables (&team);
+        STAT (begin_counts (frame, &team));
+
+        if (frame->limits_p)
+            result = iterate_search (frame);
+        else {
+            if (frame->depth) {
+                if (frame->pos.move_number == 1 && !frame->pos.move_color)
+                    frame->depth = 2;
+                else if (frame->flags & EVAL_SCALE) {
+                    int total_material = frame->pos.white_material + frame->pos.black_material;
+
+                    if (total_material < 40) frame->depth++;
+                    if (total_material < 20) frame->depth++;
+                    if (total_material < 10) frame->depth++;
+                }
+            }
+            else if (frame->bestmove_p) {
+                fprintf (stderr, "can't get bestmove with no depth!\n");
+                exit (1);
+            }
+
+            result = search_root (frame, -SCORE_LIMIT, SCORE_LIMIT);
+        }
+
+        STAT (end_counts (frame, &team));
+        disband_team (&team);
+        return result;
+    }
+
+    return search_position (frame);
+}
+
+// Search the root position once, to frame->depth, with the specified window.
+
+static void *search_root (FRAME *frame, int alpha, int beta)
+{
+    frame->alpha = alpha;
+    frame->beta = beta;
+    frame->last_to = 0;
+    frame->min_value_p = NULL;
+    frame->split_p = NULL;
+
+    if ((frame->flags & EVAL_LAZY_SMP) && frame->max_threads > 1 && frame->depth > 1)
+        return lazy_smp_search (frame);
+
+    return search_position (frame);
+}
+
+// Search the root position to increasing depths until a limit is reached (or
+// we're stopped) and return the result of the last completed iteration. Each
+// iteration leaves its best move in the hash table, which is then searched
+// first by the next one. The limits are not enforced until the first
+// iteration is complete, so unless we're explicitly stopped there's always a
+// move; if there isn't, the first legal move is returned. On a game clock we
+// plan on 30 more moves (or fewer, if that's when the clock is reset) and,
+// rather than start an iteration that probably can't finish, quit once half
+// of this move's time is gone. When pruning, each iteration after the first
+// starts with a narrow ("aspiration") window around the last score, which is
+// widened on whichever side the new score falls outside of it (and the
+// iteration searched again).
+
+#define NODE_BATCH      1024    // nodes searched between checks of the limits
+#define CLOCK_MOVES     30
+#define CLOCK_MARGIN    50      // milliseconds to leave on the clock
+#define ASPIRATION      16      // initial distance of the window from the last score
+#define MAX_PV          32      // longest principal variation passed to limits->report()
+
+#define FUTILITY_MARGIN 40      // (a pawn is about 10, more as material comes off)
+#define RAZOR_MARGIN    80
+
+static void *iterate_search (FRAME *frame)
+{
+    SEARCH_LIMITS *limits = frame->limits_p;
+    int saved_depth = frame->depth, max_depth = frame->depth, depth, score = 0;
+    MOVE *bestmove_p = frame->bestmove_p, bestmove;
+    long long start_time = current_millisecs (), budget = 0;
+
+    if (!max_depth || max_depth > MAX_DEPTH - 1)
+        max_depth = MAX_DEPTH - 1;
+
+    if (limits->move_time)
+        budget = limits->move_time;
+    else if (limits->clock_time) {
+        int moves = limits->moves_to_go > 0 && limits->moves_to_go < CLOCK_MOVES ? limits->moves_to_go : CLOCK_MOVES;
+
+        budget = limits->clock_time / moves + limits->clock_increment * 3 / 4;
+
+        if (budget > limits->clock_time - CLOCK_MARGIN)
+            budget = limits->clock_time - CLOCK_MARGIN;
+
+        if (budget < 1)
+            budget = 1;
+    }
+
+    limits->start_time = start_time;
+    limits->stop_time = budget ? start_time + budget : 0;
+    limits->nodes_searched = 0;
+    limits->depth_completed = 0;
+    frame->node_count = 0;
+
+    if (bestmove_p)
+        bestmove_p->from = 0;
+
+    for (depth = 1; depth <= max_depth; ++depth) {
+        int alpha = -SCORE_LIMIT, beta = SCORE_LIMIT, window = ASPIRATION, value, stopped;
+
+        if (depth > 1 && (frame->flags & EVAL_PRUNE)) {
+            alpha = score - window;
+            beta = score + window;
+        }
+
+        while (1) {
+            bestmove.from = 0;
+            frame->bestmove_p = &bestmove;
+            frame->depth = depth;
+            value = (int) (long) search_root (frame, alpha, beta);
+            stopped = __atomic_load_n (&limits->stop, __ATOMIC_RELAXED);
+            count_nodes (frame);
+            window *= 4;
+
+            if (stopped)
+                break;
+            else if (value <= alpha && alpha > -SCORE_LIMIT)
+                alpha = value - window > -SCORE_LIMIT ? value - window : -SCORE_LIMIT;
+            else if (value >= beta && beta < SCORE_LIMIT)
+                beta = value + window < SCORE_LIMIT ? value + window : SCORE_LIMIT;
+            else
+                break;
+        }
+
+        if (stopped)
+            break;
+
+        score = value;
+        __atomic_store_n (&limits->depth_completed, depth, __ATOMIC_RELAXED);
+
+        if (bestmove_p)
+            *bestmove_p = bestmove;
+
+        if (limits->report) {
+            MOVE pv [MAX_PV];
+
+            limits->report (limits, score, pv, hash_variation (frame, &bestmove, pv, MAX_PV));
+        }
+
+        if (!bestmove.from || __atomic_load_n (&limits->stop, __ATOMIC_RELAXED))
+            break;
+
+        if (!limits->move_time && budget && current_millisecs () - start_time >= budget / 2)
+            break;
+    }
+
+    if (bestmove_p && !limits->depth_completed) {
+        MOVE moves [MAX_MOVES + 10];
+
+        if (!frame->pos.drawn_game && generate_move_list (moves, &frame->pos))
+            *bestmove_p = moves [0];
+    }
+
+    frame->bestmove_p = bestmove_p;
+    frame->depth = saved_depth;
+    return (void *) (long) score;
+}
+
+// This is the recursive search itself. The root node is the one without
+// EVAL_INTERNAL set, and its children report the best move via bestmove_p.
+
+static void *search_position (FRAME *frame)
+{
+    int nmoves = 0, nlegal, mindex, min_value, pruned = FALSE, futile = FALSE, bestindex = -1, staged = FALSE;
+    POSITION *pos = &frame->pos;
+    MOVE moves [MAX_MOVES + 10], hashmove;
+
+    if (frame->depth < -24) {
+        fprintf (stderr, "depth = %d!\n", frame->depth);
+        exit (1);
+    }
+
+    if (frame->limits_p && ++frame->node_count == NODE_BATCH)
+        count_nodes (frame);
+
+    STAT (frame->depth > 0 || pos->in_check ? COUNTS (frame)->interior_nodes++ : COUNTS (frame)->quiesce_nodes++);
+    memset (&hashmove, 0, sizeof (hashmove));
+
+    if (frame->depth > 0 && !pos->drawn_game && probe_hash (frame, &hashmove, &min_value) &&
+        (frame->flags & EVAL_INTERNAL)) {
+            min_value = -min_value;
+            goto search_position_exit;
+    }
+
+    // The selective search (each part enabled by its own flag) only applies
+    // below the root when pruning and not in check. Null move pruning: if
+    // passing the move to the opponent (and searching to a reduced depth)
+    // still gets us a score at or above beta, then surely some real move would
+    // too (which isn't true in zugzwang, so not with only pawns left, and not
+    // twice in a row). Razoring: two plies from the leaves, if we're hopelessly
+    // below alpha, just search one ply (where futility pruning, see below, can
+    // then skip the quiet moves).
+
+    if ((frame->flags & (EVAL_INTERNAL | EVAL_PRUNE)) == (EVAL_INTERNAL | EVAL_PRUNE) &&
+        frame->depth > 0 && !pos->in_check && !pos->drawn_game &&
+        (frame->flags & (EVAL_NULL_MOVE | EVAL_FUTILITY))) {
+            int score = evaluate (frame);
+
+            if ((frame->flags & EVAL_FUTILITY) && frame->depth <= 2) {
+                if (frame->depth == 2 && score + RAZOR_MARGIN <= frame->alpha)
+                    frame->depth = 1;
+
+                futile = frame->depth == 1 && score + FUTILITY_MARGIN <= frame->alpha;
+            }
+
+            if ((frame->flags & EVAL_NULL_MOVE) && frame->depth >= 2 && frame->last_to &&
+                (pos->move_color ? pos->black_material - pos->black_pawns : pos->white_material - pos->white_pawns) &&
+                score >= node_beta (frame)) {
+                    int alpha = child_alpha (frame), bound = alpha + 1;
+
+                    search_move (frame, NULL, frame->depth - 1 - (frame->depth >= 6 ? 3 : 2), &bound, NULL, frame->thismove, alpha);
+
+                    if (bound <= alpha) {
+                        STAT (COUNTS (frame)->null_cutoffs++);
+                        min_value = bound;
+                        pruned = TRUE;
+                        goto search_position_done;
+                    }
+            }
+    }
+
+    // quiescence nodes (those past the search depth and not in check) only
+    // search captures, so that's all they generate; the other moves are then
+    // only generated (and just counted) if there are no captures, because we
+    // still need to know whether it's stalemate. Interior nodes below the root
+    // that aren't in check generate their moves in stages: the captures first,
+    // and the rest only once those have been searched without a cutoff (see
+    // add_quiet_moves()). That's unless the hash move is a quiet move, which
+    // would have to be searched first (and can't be checked for legality
+    // without generating the moves anyway).
+
+    if (pos->drawn_game)
+        nlegal = 0;
+    else if (frame->depth > 0 && !pos->in_check && (frame->flags & EVAL_INTERNAL) &&
+        (!hashmove.from || pos->board [hashmove.from + hashmove.delta]) &&
+        (nmoves = generate_capture_list (moves, pos)) != 0)
+            nlegal = staged = TRUE;
+    else if (frame->depth > 0 || pos->in_check)
+        nlegal = nmoves = generate_move_list (moves, pos);
+    else if (!(nlegal = nmoves = generate_capture_list (moves, pos)))
+        nlegal = generate_move_list (NULL, pos);
+
+    STAT (COUNTS (frame)->move_lists += pos->drawn_game ? 0 : (frame->depth > 0 || pos->in_check || nmoves) && !staged ? 1 : 2);
+
+    if (!nlegal) {
+        if (pos->drawn_game)
+            min_value = 0;
+        else if (pos->in_check)
+            min_value = 10000;
+        else {
+            pos->drawn_game = STALEMATE;
+            min_value = 0;
+        }
+
+        goto search_position_exit;
+    }
+
+    if (nmoves > MAX_MOVES) {
+        printf ("%d legal moves!\n", nmoves);
+        exit (1);
+    }
+
+    // search the moves most likely to cause a cutoff first (scrambling them
+    // beforehand just breaks the ties between moves that order the same)
+
+    if (frame->flags & EVAL_SCRAMBLE)
+        scramble_moves (frame, moves, nmoves);
+
+    order_moves (frame, moves, nmoves, &hashmove);
+
+    if (frame->depth > 0 || pos->in_check) {
+        min_value = SCORE_LIMIT;
+
+        // when pruning, scores that can't get us above alpha don't matter, so
+        // our min_value starts out just past the last one that would (and if
+        // no move lowers it, we return a score at or below alpha)
+
+        if ((frame->flags & EVAL_PRUNE) && undecay (frame->flags, -frame->alpha - 1) < min_value)
+            min_value = undecay (frame->flags, -frame->alpha - 1) + 1;
+
+        for (mindex = 0; mindex < nmoves || staged; ++mindex) {
+            int last_min_value = min_value;
+
+            if ((frame->flags & EVAL_PRUNE) && fails_high (frame, min_value)) {
+                pruned = TRUE;
+                break;
+            }
+
+            if (search_aborted (frame->split_p, frame->limits_p))
+                break;
+
+            // the captures didn't cut off, so now we need the other moves
+
+            if (staged && mindex == nmoves) {
+                nmoves = add_quiet_moves (frame, moves, nmoves, &hashmove);
+                staged = FALSE;
+
+                if (mindex == nmoves)
+                    break;
+            }
+
+            // once the eldest move has been searched, other threads can help
+            // (but only with all the moves, so not until they're generated)
+
+            if (mindex && !staged && can_split (frame)) {
+                split_node (frame, moves, mindex, nmoves, futile, &min_value, &bestindex, &pruned);
+                break;
+            }
+
+            if (frame->flags & EVAL_INTERNAL)
+                search_node_move (frame, moves + mindex, mindex, futile, &min_value, NULL, frame->thismove);
+            else
+                search_node_move (frame, moves + mindex, mindex, futile, &min_value, frame->bestmove_p, moves [mindex]);
+
+            if (min_value < last_min_value)
+                bestindex = mindex;
+        }
+
+        if (!(frame->flags & EVAL_INTERNAL) && frame->bestmove_p && bestindex >= 0)
+            *frame->bestmove_p = moves [bestindex];
+
+        if (pruned && bestindex >= 0 && !search_aborted (frame->split_p, frame->limits_p)) {
+            STAT (COUNTS (frame)->cutoffs [bestindex < MAX_CUTOFF_INDEX ? bestindex : MAX_CUTOFF_INDEX - 1]++);
+            record_cutoff (frame, moves + bestindex);
+        }
+    }
+    else {
+        min_value = -evaluate (frame);
+
+        for (mindex = 0; mindex < nmoves; ++mindex) {
+            int dest = moves [mindex].from + moves [mindex].delta, cindex;
+            int num_cap_pos = frame->num_cap_pos;
+
+            if ((frame->flags & EVAL_PRUNE) && fails_high (frame, min_value))
+                break;
+
+            for (cindex = 0; cindex < frame->num_cap_pos; ++cindex)
+                if (frame->capture_positions [cindex] == dest)
+                    break;
+
+            if (cindex == frame->num_cap_pos) {
+                if (cindex < MAX_CAP_POS)
+                    frame->capture_positions [frame->num_cap_pos++] = dest;
+                else
+                    continue;
+            }
+
+            search_move (frame, moves + mindex, frame->depth - 1, &min_value, frame->bestmove_p, frame->thismove, child_alpha (frame));
+            frame->num_cap_pos = num_cap_pos;
+        }
+    }
+
+search_position_done:
+    min_value = DECAY (frame->flags, min_value);
+
+    // if a split point above us was aborted (or a search limit was reached),
+    // our result is meaningless
+
+    if (search_aborted (frame->split_p, frame->limits_p))
+        return (void *) (long) -min_value;
+
+    // a search that was cut short by pruning only gives us a lower bound, and
+    // one where no move got us above alpha only gives us an upper bound
+
+    if (frame->depth > 0)
+        store_hash (frame, bestindex < 0 ? NULL : moves + bestindex, -min_value,
+            pruned ? HASH_LOWER : bestindex < 0 ? HASH_UPPER : HASH_EXACT);
+
+search_position_exit:
+    // the bound shared by the threads of a split point must be lowered with
+    // an atomic compare-and-swap because other threads may be lowering it too,
+    // and in that case bestmove_p points to a per-move slot that just flags
+    // the moves that lowered it (see split_node())
+
+    if (frame->min_value_p) {
+        if (frame->flags & EVAL_PTHREAD) {
+            int bound = __atomic_load_n (frame->min_value_p, __ATOMIC_RELAXED);
+
+            while (-min_value < bound)
+                if (__atomic_compare_exchange_n (frame->min_value_p, &bound, -min_value,
+                    FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                        *frame->bestmove_p = frame->thismove;
+                        break;
+                }
+        }
+        else if (-min_value < *frame->min_value_p) {
+            *frame->min_value_p = -min_value;
+
+            if (frame->bestmove_p)
+                *frame->bestmove_p = frame->thismove;
+        }
+    }
+
+    return (void *) (long) -min_value;
+}
+
+// Search the specified move from the specified node by making it in the
+// node's own frame, searching the resulting child position to the specified
+// depth (with the specified alpha, and the node's min_value as its beta), and
+// then taking it back. A NULL move is a "null" move (see make_null_move()).
+// The frame's search parameters are set up for the child and then restored,
+// so the frame is left exactly as it was found. If min_value_p is the shared
+// bound of the split point the node is being searched from, the child lowers
+// it atomically (see search_position()). Returns the child's score.
+
+static int search_move (FRAME *frame, MOVE *move, int depth, int *min_value_p, MOVE *bestmove_p, MOVE thismove, int alpha)
+{
+    int *saved_min_value_p = frame->min_value_p, flags = frame->flags, saved_depth = frame->depth, score;
+    int saved_alpha = frame->alpha, saved_beta = frame->beta, saved_last_to = frame->last_to;
+    MOVE *saved_bestmove_p = frame->bestmove_p, saved_thismove = frame->thismove;
+    UNDO undo;
+
+    if (move) {
+        make_move (frame, move, &undo);
+        frame->last_to = move->from + move->delta;
+    }
+    else {
+        make_null_move (frame, &undo);
+        frame->last_to = 0;
+    }
+
+    frame->flags |= EVAL_INTERNAL;
+    frame->flags &= ~EVAL_PTHREAD;
+
+    if (frame->split_p && min_value_p == &frame->split_p->min_value)
+        frame->flags |= EVAL_PTHREAD;
+
+    frame->min_value_p = min_value_p;
+    frame->bestmove_p = bestmove_p;
+    frame->thismove = thismove;
+    frame->alpha = alpha;
+    frame->beta = SCORE_LIMIT;
+    frame->depth = depth;
+
+    score = (int) (long) search_position (frame);
+
+    frame->depth = saved_depth;
+    frame->last_to = saved_last_to;
+    frame->beta = saved_beta;
+    frame->alpha = saved_alpha;
+    frame->thismove = saved_thismove;
+    frame->bestmove_p = saved_bestmove_p;
+    frame->min_value_p = saved_min_value_p;
+    frame->flags = flags;
+
+    if (move)
+        unmake_move (frame, move, &undo);
+    else
+        unmake_null_move (frame, &undo);
+
+    return score;
+}
+
+// Search the specified move (at index "mindex" in the node's ordered list)
+// from the specified node with the selective search, which is done the same
+// way whether the node is being searched by one thread or from a split point.
+// Futility pruning: at the last ply, if we're far enough below alpha
+// ("futile") a quiet move isn't going to get us there (unless it's check).
+// Principal variation search: after the first move, first just try to show
+// (with a null window) that each move is no better than min_value, and only
+// search it fully if that fails; late quiet moves (which are very unlikely to
+// be better) are tried at a reduced depth first. The full search lowers
+// *min_value_p (and sets *bestmove_p to "thismove") if the move is better.
+// Returns the score from the full search, or SCORE_LIMIT if there wasn't one.
+
+static int search_node_move (FRAME *frame, MOVE *move, int mindex, int futile, int *min_value_p, MOVE *bestmove_p, MOVE thismove)
+{
+    POSITION *pos = &frame->pos;
+
+    if (futile && mindex && is_quiet (pos, move)) {
+        int check;
+        UNDO undo;
+
+        make_move (frame, move, &undo);
+        check = pos->in_check;
+        unmake_move (frame, move, &undo);
+
+        if (!check)
+            return SCORE_LIMIT;
+    }
+
+    if (mindex && (frame->flags & EVAL_PRUNE)) {
+        int min_value = __atomic_load_n (min_value_p, __ATOMIC_RELAXED), bound = min_value, reduction = 0;
+
+        if ((frame->flags & EVAL_REDUCE) && frame->depth >= 3 && mindex >= 3 &&
+            !pos->in_check && is_quiet (pos, move))
+                reduction = (frame->depth >= 5 && mindex >= 8) ? 2 : 1;
+
+        search_move (frame, move, frame->depth - 1 - reduction, &bound, NULL, thismove, min_value - 1);
+
+        if (bound == min_value)
+            return SCORE_LIMIT;
+
+        if (reduction) {
+            bound = min_value;
+            search_move (frame, move, frame->depth - 1, &bound, NULL, thismove, min_value - 1);
+
+            if (bound == min_value)
+                return SCORE_LIMIT;
+        }
+    }
+
+    return search_move (frame, move, frame->depth - 1, min_value_p, bestmove_p, thismove, child_alpha (frame));
+}
+
+// Make a "null" move (i.e., just pass the move to the other side) in the
+// specified frame, which is only done in the search to see if the side to
+// move is doing well enough that it doesn't even need a move. Nothing on the
+// board changes, so only the fields saved here are affected, and since we
+// can't be in check (or we couldn't pass) the opponent isn't either. We
+// don't look for repeated positions across a null move.
+
+static void make_null_move (FRAME *frame, UNDO *undo)
+{
+    POSITION *pos = &frame->pos;
+
+    undo->key = pos->key;
+    undo->reversable_moves = pos->reversable_moves;
+    undo->white_epsquare = pos->white_epsquare;
+    undo->black_epsquare = pos->black_epsquare;
+
+    if (pos->white_epsquare)
+        pos->key ^= zobrist_epsquare [pos->white_epsquare];
+    else if (pos->black_epsquare)
+        pos->key ^= zobrist_epsquare [pos->black_epsquare];
+
+    pos->key ^= zobrist_color;
+    pos->white_epsquare = pos->black_epsquare = 0;
+    pos->reversable_moves = 0;
+
+    if (!(pos->move_color ^= COLOR))
+        ++pos->move_number;
+
+    HISTORY_KEY (frame, PLY (pos)) = pos->key;
+}
+
+static void unmake_null_move (FRAME *frame, UNDO *undo)
+{
+    POSITION *pos = &frame->pos;
+
+    if (!pos->move_color)
+        --pos->move_number;
+
+    pos->move_color ^= COLOR;
+    pos->key = undo->key;
+    pos->reversable_moves = undo->reversable_moves;
+    pos->white_epsquare = undo->white_epsquare;
+    pos->black_epsquare = undo->black_epsquare;
+}
+
+// Return the static evaluation of the specified frame's position from the
+// perspective of the side to move: the material ratio and, with
+// EVAL_POSITION, center pawns and mobility.
+
+static int evaluate (FRAME *frame)
+{
+    POSITION *pos = &frame->pos;
+    int score;
+
+    STAT (COUNTS (frame)->evaluations++);
+
+    if (pos->white_material > MAX_MATERIAL || pos->black_material > MAX_MATERIAL)
+        fprintf (stderr, "warning: material too high!\n");
+
+    if (pos->white_material > pos->black_material)
+        score = (pos->white_material + 10) * 500 /
+            (pos->black_material + 10) - 500;
+    else
+        score = -((pos->black_material + 10) * 500 /
+            (pos->white_material + 10) - 500);
+
+    if (pos->move_color)
+        score = -score;
+
+    if (frame->flags & EVAL_POSITION) {
+        score -= count_center_pawns (pos, pos->move_color ^ COLOR) * 2;
+        score += count_center_pawns (pos, pos->move_color) * 2;
+        score -= count_mobility (pos, pos->move_color ^ COLOR);
+        score += count_mobility (pos, pos->move_color);
+    }
+
+    return score;
+}
+
+// Return TRUE if the specified move is "quiet" (not a capture or promotion).
+
+static int is_quiet (POSITION *pos, MOVE *move)
+{
+    return !pos->board [move->from + move->delta] && !move->promo &&
+        ((pos->board [move->from] & PIECE) != PAWN || !(move->delta & 1));
+}
+
+// A node's search window is [alpha, beta] in terms of the score it returns
+// (from the perspective of its side to move). Its parent's min_value (which
+// may be lowered by other threads at a split point) is also a beta, and the
+// lower of the two is used.
+
+static int node_beta (FRAME *frame)
+{
+    int beta = frame->beta;
+
+    if (frame->min_value_p) {
+        int min_value = __atomic_load_n (frame->min_value_p, __ATOMIC_RELAXED);
+
+        if (min_value < beta)
+            beta = min_value;
+    }
+
+    return beta;
+}
+
+// Return TRUE if the specified min_value would give the node a score at or
+// above beta, which means it can stop searching.
+
+static int fails_high (FRAME *frame, int min_value)
+{
+    return -DECAY (frame->flags, min_value) >= node_beta (frame);
+}
+
+// Return the alpha for searching a move from the specified node, which is
+// the highest score that would make the node fail high (so that a move doing
+// that well for the opponent doesn't need to be distinguished from any other
+// that does).
+
+static int child_alpha (FRAME *frame)
+{
+    if (!(frame->flags & EVAL_PRUNE))
+        return -SCORE_LIMIT;
+
+    return undecay (frame->flags, -node_beta (frame));
+}
+
+// Return the highest min_value that, once decayed (if enabled), is no higher
+// than the specified value. This translates a bound on a node's score into
+// a bound on the scores of its moves.
+
+static int undecay (int flags, int value)
+{
+    int min_value = value;
+
+    if (flags & EVAL_DECAY) {
+        min_value += (value + 128) >> 8;
+
+        while (DECAY (flags, min_value) > value)
+            min_value--;
+
+        while (DECAY (flags, min_value + 1) <= value)
+            min_value++;
+    }
+
+    return min_value;
+}
+
+// Return the number of moves to mate given by a search's score (from the
+// side to move, so it's negative if that side is getting mated), or 0 if
+// the score isn't a mate. With EVAL_DECAY the mate score (10000) has been
+// decayed once for each ply to the mate, so the distance follows from the
+// score; otherwise every mate scores the same and the length of the
+// principal variation has to be used instead.
+
+int mate_moves (int score, int pv_length)
+{
+    int value = 10000, plies = 0;
+
+    if (score >= -5000 && score <= 5000)
+        return 0;
+
+    if (score == 10000 || score == -10000)
+        plies = pv_length;
+    else
+        while (value > score && value > -score) {
+            value = DECAY (EVAL_DECAY, value);
+            plies++;
+        }
+
+    return score > 0 ? (plies + 1) / 2 : -(plies / 2);
+}
+
+// Add the nodes the specified frame has searched to the total and, once the
+// first iteration is complete, stop the search if it's past a limit. This is
+// only done every NODE_BATCH nodes so that the threads aren't all constantly
+// updating the shared total (or checking the time).
+
+static void count_nodes (FRAME *frame)
 {
-    FRAME *frame = (FRAME *) threadid;
-    int nmoves, mindex, min_value;
-    MOVE moves [MAX_MOVES + 10];
+    SEARCH_LIMITS *limits = frame->limits_p;
+    long long nodes = __atomic_add_fetch (&limits->nodes_searched, frame->node_count, __ATOMIC_RELAXED);
 
-    if (!(frame->flags & EVAL_INTERNAL)) {
-        if (frame->depth < 0) {
-            fprintf (stderr, "calling eval_position() with depth = %d!\n", frame->depth);
-            exit (1);
-        }
+    frame->node_count = 0;
 
-        if (frame->depth) {
-            if (frame->move_number == 1 && !frame->move_color)
-                frame->depth = 2;
-            else if (frame->flags & EVAL_SCALE) {
-                int total_material = frame->white_material + frame->black_material;
+    if (__atomic_load_n (&limits->depth_completed, __ATOMIC_RELAXED) &&
+        ((limits->max_nodes && nodes >= limits->max_nodes) ||
+        (limits->stop_time && current_millisecs () >= limits->stop_time)))
+            __atomic_store_n (&limits->stop, TRUE, __ATOMIC_RELAXED);
+}
 
-                if (total_material < 40) frame->depth++;
-                if (total_material < 20) frame->depth++;
-                if (total_material < 10) frame->depth++;
-            }
-        }
-        else if (frame->bestmove_p) {
-            fprintf (stderr, "can't get bestmove with no depth!\n");
-            exit (1);
-        }
+// Get the principal variation by following the hash moves from the root,
+// starting with the best move found. An entry might have been replaced (or
+// be from another line) so each move is checked against the legal moves, and
+// it stops at a drawn (e.g., repeated) position so it can't go on forever.
 
-        frame->min_value_p = NULL;
-    }
+static int hash_variation (FRAME *frame, MOVE *bestmove, MOVE pv [], int max_moves)
+{
+    MOVE move = *bestmove, moves [MAX_MOVES + 10];
+    uint64_t history [MAX_HISTORY];
+    int length = 0, nmoves, mindex, score;
+    FRAME temp = *frame;
 
-    if (frame->depth < -24) {
-        fprintf (stderr, "depth = %d!\n", frame->depth);
-        exit (1);
-    }
+    memcpy (history, frame->history, sizeof (history));
+    temp.history = history;
+    temp.depth = MAX_DEPTH;     // deeper than any entry, so probe_hash() only gets the move
 
-    if (frame->drawn_game || !(nmoves = generate_move_list (moves, frame))) {
-        if (frame->drawn_game)
-            min_value = 0;
-        else if (frame->in_check)
-            min_value = 10000;
-        else {
-            frame->drawn_game = STALEMATE;
-            min_value = 0;
-        }
+    while (move.from && length < max_moves && !temp.pos.drawn_game) {
+        nmoves = generate_move_list (moves, &temp.pos);
 
-        goto eval_position_exit;
-    }
+        for (mindex = 0; mindex < nmoves; ++mindex)
+            if (SAME_MOVE (moves [mindex], move))
+                break;
 
-    if (nmoves > MAX_MOVES) {
-        printf ("%d legal moves!\n", nmoves);
-        exit (1);
-    }
+        if (mindex == nmoves)
+            break;
 
-    if (frame->flags & EVAL_SCRAMBLE)
-        scramble_moves (moves, nmoves);
-
-    if (frame->depth > 0 || frame->in_check) {
-        min_value = 20000;
-
-        if (!(frame->flags & EVAL_INTERNAL) && nmoves > 1 && frame->max_threads > 1 && frame->depth > 2) {
-            int running_threads = 0, dindex;
-            FRAME *frames [MAX_MOVES + 10];
-
-            for (mindex = 0; mindex < nmoves || running_threads;) {
-
-                while (mindex < nmoves && running_threads < frame->max_threads) {
-                    frames [mindex] = malloc (sizeof (FRAME));
-                    *frames [mindex] = *frame;
-                    execute_move (frames [mindex], moves + mindex);
-                    frames [mindex]->depth--;
-                    frames [mindex]->done = 0;
-                    frames [mindex]->thismove = moves [mindex];
-                    frames [mindex]->min_value_p = &min_value;
-                    frames [mindex]->flags |= EVAL_INTERNAL | EVAL_PTHREAD;
-                    pthread_mutex_init (&frames [mindex]->mutex, NULL);
-                    pthread_create (&frames [mindex]->pthread, NULL, eval_position, (void *) frames [mindex]);
-                    running_threads++;
-                    mindex++;
-                }
-
-                for (dindex = 0; dindex < mindex; ++dindex)
-                    if (frames [dindex] && frames [dindex]->done) {
-                        pthread_join (frames [dindex]->pthread, NULL);
-                        pthread_mutex_destroy (&frames [dindex]->mutex);
-                        free (frames [dindex]);
-                        frames [dindex] = NULL;
-                        running_threads--;
-                        dindex = -1;
-                    }
+        execute_move (&temp, &move);
+        pv [length++] = move;
+        move.from = 0;
+        probe_hash (&temp, &move, &score);
+    }
 
-                if (running_threads == frame->max_threads || (running_threads && mindex == nmoves))
-                    usleep (1000);
-            }
-        }
-        else {
-            FRAME temp;
+    return length;
+}
 
-            for (mindex = 0; mindex < nmoves; ++mindex) {
-                if ((frame->flags & EVAL_PRUNE) && frame->min_value_p) {
-                    int min_value_ret = min_value;
+// Return the current time in milliseconds.
 
-                    if (frame->flags & EVAL_DECAY)
-                        min_value_ret -= (min_value_ret + 128) >> 8;
+long long current_millisecs (void)
+{
+    struct timeval time;
 
-                    if (-min_value_ret >= *frame->min_value_p)
-                        break;
-                }
+    gettimeofday (&time, NULL);
+    return time.tv_sec * 1000LL + time.tv_usec / 1000;
+}
 
-                temp = *frame;
-                execute_move (&temp, moves + mindex);
-                temp.flags |= EVAL_INTERNAL;
-                temp.flags &= ~EVAL_PTHREAD;
-                temp.min_value_p = &min_value;
-                temp.depth--;
+#ifdef SEARCH_STATS
 
-                if (frame->flags & EVAL_INTERNAL)
-                    temp.bestmove_p = NULL;
-                else
-                    temp.thismove = moves [mindex];
+// Clear the counts of the thread states in the specified frame's team (the
+// ones its search and its helpers use) and note when it started (which is
+// when the helper states start being idle).
 
-                eval_position (&temp);
-            }
-        }
-    }
-    else {
-        if (frame->white_material > MAX_MATERIAL || frame->black_material > MAX_MATERIAL)
-            fprintf (stderr, "warning: material too high!\n");
+static void begin_counts (FRAME *frame, SEARCH_TEAM *team)
+{
+    int mindex;
 
-        if (frame->white_material > frame->black_material)
-            min_value = (frame->white_material + 10) * 500 /
-                (frame->black_material + 10) - 500;
-        else
-            min_value = -((frame->black_material + 10) * 500 /
-                (frame->white_material + 10) - 500);
+    if (!frame->counts_p)
+        return;
 
-        if (!frame->move_color)
-            min_value = -min_value;
+    for (mindex = 0; mindex < team->nmembers; ++mindex)
+        memset (&thread_states [team->members [mindex]].counts, 0, sizeof (SEARCH_COUNTS));
 
-        if (frame->flags & EVAL_POSITION) {
-            min_value += count_center_pawns (frame, frame->move_color ^ COLOR) * 2;
-            min_value -= count_center_pawns (frame, frame->move_color) * 2;
-            frame->move_color ^= COLOR;
-            min_value += generate_move_list (NULL, frame) - nmoves;
-            frame->move_color ^= COLOR;
-        }
+    frame->counts_p->usecs = current_usecs ();
 
-        for (mindex = 0; mindex < nmoves; ++mindex) {
-            int dest = moves [mindex].from + moves [mindex].delta, cindex;
-            FRAME temp;
+    for (mindex = 0; mindex < team->nhelpers; ++mindex)
+        thread_states [team->helpers [mindex]].idle_start = frame->counts_p->usecs;
+}
 
-            if ((frame->flags & EVAL_PRUNE) && frame->min_value_p) {
-                int min_value_ret = min_value;
+// Add up the counts of the thread states in the team of the search just
+// completed (see above) in frame->counts_p, after counting the time since
+// each helper state was last used as idle.
 
-                if (frame->flags & EVAL_DECAY)
-                    min_value_ret -= (min_value_ret + 128) >> 8;
+static void end_counts (FRAME *frame, SEARCH_TEAM *team)
+{
+    int mindex, cindex;
+    SEARCH_COUNTS *sum = frame->counts_p;
+    long long start_time;
 
-                if (-min_value_ret >= *frame->min_value_p)
-                    break;
-            }
+    if (!sum)
+        return;
 
-            if (!frame->board [dest])
-                continue;
+    for (mindex = 0; mindex < team->nhelpers; ++mindex)
+        end_idle (team->helpers [mindex]);
 
-            temp = *frame;
+    start_time = sum->usecs;
+    memset (sum, 0, sizeof (SEARCH_COUNTS));
+    sum->usecs = current_usecs () - start_time;
+    sum->threads = team->nmembers;
+    sum->depth = frame->limits_p ? frame->limits_p->depth_completed : frame->depth;
 
-            for (cindex = 0; cindex < temp.num_cap_pos; ++cindex)
-                if (temp.capture_positions [cindex] == dest)
-                    break;
+    for (mindex = 0; mindex < team->nmembers; ++mindex) {
+        SEARCH_COUNTS *counts = &thread_states [team->members [mindex]].counts;
 
-            if (cindex == temp.num_cap_pos) {
-                if (cindex < MAX_CAP_POS)
-                    temp.capture_positions [temp.num_cap_pos++] = dest;
-                else
-                    continue;
-            }
+        sum->interior_nodes += counts->interior_nodes;
+        sum->quiesce_nodes += counts->quiesce_nodes;
+        sum->evaluations += counts->evaluations;
+        sum->move_lists += counts->move_lists;
 
-            execute_move (&temp, moves + mindex);
-            temp.flags |= EVAL_INTERNAL;
-            temp.flags &= ~EVAL_PTHREAD;
-            temp.min_value_p = &min_value;
-            temp.depth--;
+        for (cindex = 0; cindex < MAX_CUTOFF_INDEX; ++cindex)
+            sum->cutoffs [cindex] += counts->cutoffs [cindex];
 
-            eval_position (&temp);
-        }
+        sum->null_cutoffs += counts->null_cutoffs;
+        sum->splits += counts->splits;
+        sum->helps += counts->helps;
+        sum->idle_usecs += counts->idle_usecs;
     }
+}
 
-    if (frame->flags & EVAL_DECAY)
-        min_value -= (min_value + 128) >> 8;
+// A thread state that isn't being searched with (because the thread using it
+// is waiting for its helpers, or because it's a free helper state) notes when
+// that started, and counts the time when it's being used again.
 
-eval_position_exit:
-    if (frame->min_value_p) {
-        if (frame->flags & EVAL_PTHREAD)
-            pthread_mutex_lock (&frame->mutex);
+static void begin_idle (int thread_index)
+{
+    thread_states [thread_index].idle_start = current_usecs ();
+}
 
-        if (-min_value < *frame->min_value_p) {
-            *frame->min_value_p = -min_value;
+static void end_idle (int thread_index)
+{
+    THREAD_STATE *state = thread_states + thread_index;
 
-            if (frame->bestmove_p)
-                *frame->bestmove_p = frame->thismove;
-        }
+    state->counts.idle_usecs += current_usecs () - state->idle_start;
+}
 
-        if (frame->flags & EVAL_PTHREAD)
-            pthread_mutex_unlock (&frame->mutex);
-    }
+static long long current_usecs (void)
+{
+    struct timeval time;
 
-    frame->done = 1;
-    return (void *) (long) -min_value;
+    gettimeofday (&time, NULL);
+    return time.tv_sec * 1000000LL + time.tv_usec;
 }
 
-static int in_check (FRAME *frame)
+#endif
+
+static int in_check (POSITION *pos)
 {
-    int kindex = frame->move_color ? frame->black_king : frame->white_king;
-    return check_attack (&frame->board [kindex], frame->move_color ^ COLOR);
+#ifdef BITBOARDS
+    return bb_in_check (pos);
+#else
+    int kindex = pos->move_color ? pos->black_king : pos->white_king;
+    return check_attack (&pos->board [kindex], pos->move_color ^ COLOR);
+#endif
 }
 
+// This is the board-based move generator (and its attack detection), which
+// is replaced by the one in bitboards.c when BITBOARDS is defined.
+
+#ifndef BITBOARDS
+
 #define attackpath(dir, mask)                                   \
     if ((*(src = dst + dir) & (PIECE | COLOR)) == ktest)        \
         return TRUE;                                            \
@@ -361,19 +2243,18 @@ static int check_attack (square *dst, int color)
         for (src = pin + dir; !*src; src += dir);       \
                                                         \
         if ((*src & (mask | COLOR)) == test)            \
-            *pin |= PINNED;                             \
+            *(pins [npins++] = pin) |= PINNED;          \
     }                                                   \
 
-static void set_pinned_status (FRAME *frame)
-{
-    int kindex = frame->move_color ? frame->black_king : frame->white_king;
-    square *dst = &frame->board [kindex], *pin, *src;
-    int rank, file, test;
+// Mark the pieces of the side to move that are pinned against their king,
+// storing their locations in pins [] so that generate_move_list() can clear
+// them again when it's done (rather than clearing the whole board first).
 
-    for (rank = 1; rank <= BOARD_SIDE; ++rank)
-        for (file = 1; file <= BOARD_SIDE; ++file)
-            if (SQUARE (frame, rank, file) & PINNED)
-                SQUARE (frame, rank, file) &= ~PINNED;
+static int set_pinned_status (POSITION *pos, square *pins [])
+{
+    int kindex = pos->move_color ? pos->black_king : pos->white_king;
+    square *dst = &pos->board [kindex], *pin, *src;
+    int npins = 0, test;
 
     test = BISHOP | (~*dst & COLOR);
 
@@ -388,6 +2269,8 @@ static void set_pinned_status (FRAME *frame)
     pinpath (ORTHOG2, ROOK);
     pinpath (ORTHOG3, ROOK);
     pinpath (ORTHOG4, ROOK);
+
+    return npins;
 }
 
 #define genmove(dir)                                    \
@@ -401,7 +2284,7 @@ static void set_pinned_status (FRAME *frame)
                                                         \
             capture_temp = *dst; *dst = *src; *src = 0; \
                                                         \
-            if (!in_check (frame))                      \
+            if (!in_check (pos))                        \
                 *listptr++ = move;                      \
                                                         \
             *src = *dst; *dst = capture_temp;           \
@@ -425,7 +2308,7 @@ static void set_pinned_status (FRAME *frame)
                                                         \
             capture_temp = *dst; *dst = *src; *src = 0; \
                                                         \
-            if (!in_check (frame))                      \
+            if (!in_check (pos))                        \
                 *listptr++ = move;                      \
                                                         \
             if (*src = *dst, *dst = capture_temp)       \
@@ -450,7 +2333,7 @@ static void set_pinned_status (FRAME *frame)
                                                         \
             capture_temp = *dst; *dst = *src; *src = 0; \
                                                         \
-            if (!in_check (frame)) {                    \
+            if (!in_check (pos)) {                      \
                 if (rank == 9 - (startrank))            \
                     for (move.promo = KNIGHT;           \
                         move.promo &= PIECE;            \
@@ -478,10 +2361,10 @@ static void set_pinned_status (FRAME *frame)
     if (move.from + epdir == epsqr) {                   \
                                                         \
         *(dst = src + (move.delta = dir)) = *src;       \
-        capture_temp = *(cap = &frame->board [epsqr]);  \
+        capture_temp = *(cap = &pos->board [epsqr]);    \
         *cap = *src = 0;                                \
                                                         \
-        if (!in_check (frame))                          \
+        if (!in_check (pos))                            \
             *listptr++ = move;                          \
                                                         \
         *cap = capture_temp;                            \
@@ -494,7 +2377,7 @@ static void set_pinned_status (FRAME *frame)
                                                         \
         *dst = *src; *src = 0;                          \
                                                         \
-        if (!in_check (frame)) {                        \
+        if (!in_check (pos)) {                          \
                                                         \
             if (rank == (9 - (startrank)))              \
                 for (move.promo = KNIGHT;               \
@@ -511,7 +2394,7 @@ static void set_pinned_status (FRAME *frame)
                                                         \
                 *dst = *src; *src = 0;                  \
                                                         \
-                if (!in_check (frame))                  \
+                if (!in_check (pos))                    \
                     *listptr++ = move;                  \
                                                         \
                 *src = *dst; *dst = 0;                  \
@@ -527,249 +2410,727 @@ static void set_pinned_status (FRAME *frame)
         else {                                          \
             *listptr++ = move;                          \
                                                         \
-            if (rank == (startrank) &&                  \
-                !src [move.delta += dir])               \
-                    *listptr++ = move;                  \
-        }                                               \
+            if (rank == (startrank) &&                  \
+                !src [move.delta += dir])               \
+                    *listptr++ = move;                  \
+        }                                               \
+    }
+
+int generate_move_list (MOVE list [], POSITION *pos)
+{
+    int color = pos->move_color >> 3, npins = 0, pindex, rank;
+    square *src, *dst, *cap, capture_temp, *pins [8];
+    MOVE local_list [MAX_MOVES + 10], *listptr, move;
+
+    if (!list)
+        listptr = list = local_list;
+    else
+        listptr = list;
+
+    if (!pos->in_check)
+        npins = set_pinned_status (pos, pins);
+
+    move.promo = 0;
+
+    for (pindex = 0; pindex < pos->piece_counts [color]; ++pindex) {
+
+        src = &pos->board [move.from = pos->piece_lists [color] [pindex]];
+        rank = move.from / (BOARD_SIDE + 4) - 1;
+
+        switch (*src & (PIECE | COLOR)) {
+
+            case BISHOP | COLOR:
+            case QUEEN | COLOR:
+            case BISHOP:
+            case QUEEN:
+
+                if (pos->in_check || (*src & PINNED)) {
+
+                    checkpath (DIAG1);
+                    checkpath (DIAG2);
+                    checkpath (DIAG3);
+                    checkpath (DIAG4);
+                }
+                else {
+                    genpath (DIAG1);
+                    genpath (DIAG2);
+                    genpath (DIAG3);
+                    genpath (DIAG4);
+                }
+
+                if ((*src & PIECE) == BISHOP)
+                    break;
+
+            case ROOK | COLOR:
+            case ROOK:
+
+                if (pos->in_check || (*src & PINNED)) {
+
+                    checkpath (ORTHOG1);
+                    checkpath (ORTHOG2);
+                    checkpath (ORTHOG3);
+                    checkpath (ORTHOG4);
+                }
+                else {
+                    genpath (ORTHOG1);
+                    genpath (ORTHOG2);
+                    genpath (ORTHOG3);
+                    genpath (ORTHOG4);
+                }
+
+                break;
+
+            case KNIGHT | COLOR:
+            case KNIGHT:
+
+                if (pos->in_check) {
+
+                    checkmove (KNIGHT1);
+                    checkmove (KNIGHT2);
+                    checkmove (KNIGHT3);
+                    checkmove (KNIGHT4);
+                    checkmove (KNIGHT5);
+                    checkmove (KNIGHT6);
+                    checkmove (KNIGHT7);
+                    checkmove (KNIGHT8);
+                }
+                else if (!(*src & PINNED)) {
+
+                    genmove (KNIGHT1);
+                    genmove (KNIGHT2);
+                    genmove (KNIGHT3);
+                    genmove (KNIGHT4);
+                    genmove (KNIGHT5);
+                    genmove (KNIGHT6);
+                    genmove (KNIGHT7);
+                    genmove (KNIGHT8);
+                }
+
+                break;
+
+            case KING | COLOR:
+            case KING:
+
+                genkmove (ORTHOG1);
+                genkmove (ORTHOG2);
+                genkmove (ORTHOG3);
+                genkmove (ORTHOG4);
+                genkmove (DIAG1);
+                genkmove (DIAG2);
+                genkmove (DIAG3);
+                genkmove (DIAG4);
+
+                if (!pos->in_check && !(*src & MOVED)) {
+
+                    if (!src [1] && !src [2] &&
+                        ((src [3] & (PIECE | MOVED)) == ROOK) &&
+                        !check_attack (src + 1, ~*src & COLOR) &&
+                        !check_attack (src + 2, ~*src & COLOR)) {
+
+                            move.delta = KINGOO;
+                            *listptr++ = move;
+                    }
+
+                    if (!src [-1] && !src [-2] && !src [-3] &&
+                        ((src [-4] & (PIECE | MOVED)) == ROOK) &&
+                        !check_attack (src - 1, ~*src & COLOR) &&
+                        !check_attack (src - 2, ~*src & COLOR)) {
+
+                            move.delta = KINGOOO;
+                            *listptr++ = move;
+                    }
+                }
+
+                break;
+
+            case PAWN | COLOR:
+
+                if (pos->in_check || (*src & PINNED)) {
+                    checkpmove (BPAWN1, BPRANK);
+                    checkpcap (BPCAP1, BPRANK);
+                    checkpcap (BPCAP2, BPRANK);
+                }
+                else {
+                    genpmove (BPAWN1, BPRANK);
+                    genpcap (BPCAP1, BPRANK);
+                    genpcap (BPCAP2, BPRANK);
+                }
+
+                genpepx (BPCAP1, BPEPX1, pos->white_epsquare);
+                genpepx (BPCAP2, BPEPX2, pos->white_epsquare);
+                break;
+
+            case PAWN:
+
+                if (pos->in_check || (*src & PINNED)) {
+                    checkpmove (WPAWN1, WPRANK);
+                    checkpcap (WPCAP1, WPRANK);
+                    checkpcap (WPCAP2, WPRANK);
+                }
+                else {
+                    genpmove (WPAWN1, WPRANK);
+                    genpcap (WPCAP1, WPRANK);
+                    genpcap (WPCAP2, WPRANK);
+                }
+
+                genpepx (WPCAP1, WPEPX1, pos->black_epsquare);
+                genpepx (WPCAP2, WPEPX2, pos->black_epsquare);
+                break;
+        }
+    }
+
+    while (npins)
+        *pins [--npins] &= ~PINNED;
+
+    return listptr - list;
+}
+
+// These are the capture-only versions of the macros above. A slider skips
+// straight to the first piece in its path, which is the only thing that it
+// can capture in that direction.
+
+#define gencap(dir)                                     \
+    if ((*(dst = src + (move.delta = dir)) & PIECE) &&  \
+        ((*dst ^ *src) & COLOR))                        \
+            *listptr++ = move;                          \
+
+#define checkcap(dir)                                   \
+    if ((*(dst = src + (move.delta = dir)) & PIECE) &&  \
+        ((*dst ^ *src) & COLOR)) {                      \
+                                                        \
+            capture_temp = *dst; *dst = *src; *src = 0; \
+                                                        \
+            if (!in_check (pos))                        \
+                *listptr++ = move;                      \
+                                                        \
+            *src = *dst; *dst = capture_temp;           \
+    }
+
+#define gencappath(dir)                                 \
+    for (move.delta = dir; !src [move.delta];           \
+        move.delta += dir);                             \
+                                                        \
+    if ((*(dst = src + move.delta) & PIECE) &&          \
+        ((*dst ^ *src) & COLOR))                        \
+            *listptr++ = move;                          \
+
+#define checkcappath(dir)                               \
+    for (move.delta = dir; !src [move.delta];           \
+        move.delta += dir);                             \
+                                                        \
+    if ((*(dst = src + move.delta) & PIECE) &&          \
+        ((*dst ^ *src) & COLOR)) {                      \
+                                                        \
+            capture_temp = *dst; *dst = *src; *src = 0; \
+                                                        \
+            if (!in_check (pos))                        \
+                *listptr++ = move;                      \
+                                                        \
+            *src = *dst; *dst = capture_temp;           \
+    }
+
+#define genkcap(dir)                                    \
+    if ((*(dst = src + (move.delta = dir)) & PIECE) &&  \
+        ((*dst ^ *src) & COLOR)) {                      \
+                                                        \
+            capture_temp = *dst; *dst = *src; *src = 0; \
+                                                        \
+            if (!check_attack (dst, ~*dst & COLOR))     \
+                *listptr++ = move;                      \
+                                                        \
+            *src = *dst; *dst = capture_temp;           \
+    }
+
+// Generate just the legal captures in the specified position (i.e., the
+// moves onto squares occupied by the other side, including promotions that
+// capture, but not en passant). These are the same moves, in the same order,
+// that generate_move_list() would produce for those squares, and are all
+// that the quiescence search looks at.
+
+int generate_capture_list (MOVE list [], POSITION *pos)
+{
+    int color = pos->move_color >> 3, npins = 0, pindex, rank;
+    square *src, *dst, capture_temp, *pins [8];
+    MOVE local_list [MAX_MOVES + 10], *listptr, move;
+
+    if (!list)
+        listptr = list = local_list;
+    else
+        listptr = list;
+
+    if (!pos->in_check)
+        npins = set_pinned_status (pos, pins);
+
+    move.promo = 0;
+
+    for (pindex = 0; pindex < pos->piece_counts [color]; ++pindex) {
+
+        src = &pos->board [move.from = pos->piece_lists [color] [pindex]];
+        rank = move.from / (BOARD_SIDE + 4) - 1;
+
+        switch (*src & (PIECE | COLOR)) {
+
+            case BISHOP | COLOR:
+            case QUEEN | COLOR:
+            case BISHOP:
+            case QUEEN:
+
+                if (pos->in_check || (*src & PINNED)) {
+
+                    checkcappath (DIAG1);
+                    checkcappath (DIAG2);
+                    checkcappath (DIAG3);
+                    checkcappath (DIAG4);
+                }
+                else {
+                    gencappath (DIAG1);
+                    gencappath (DIAG2);
+                    gencappath (DIAG3);
+                    gencappath (DIAG4);
+                }
+
+                if ((*src & PIECE) == BISHOP)
+                    break;
+
+            case ROOK | COLOR:
+            case ROOK:
+
+                if (pos->in_check || (*src & PINNED)) {
+
+                    checkcappath (ORTHOG1);
+                    checkcappath (ORTHOG2);
+                    checkcappath (ORTHOG3);
+                    checkcappath (ORTHOG4);
+                }
+                else {
+                    gencappath (ORTHOG1);
+                    gencappath (ORTHOG2);
+                    gencappath (ORTHOG3);
+                    gencappath (ORTHOG4);
+                }
+
+                break;
+
+            case KNIGHT | COLOR:
+            case KNIGHT:
+
+                if (pos->in_check) {
+
+                    checkcap (KNIGHT1);
+                    checkcap (KNIGHT2);
+                    checkcap (KNIGHT3);
+                    checkcap (KNIGHT4);
+                    checkcap (KNIGHT5);
+                    checkcap (KNIGHT6);
+                    checkcap (KNIGHT7);
+                    checkcap (KNIGHT8);
+                }
+                else if (!(*src & PINNED)) {
+
+                    gencap (KNIGHT1);
+                    gencap (KNIGHT2);
+                    gencap (KNIGHT3);
+                    gencap (KNIGHT4);
+                    gencap (KNIGHT5);
+                    gencap (KNIGHT6);
+                    gencap (KNIGHT7);
+                    gencap (KNIGHT8);
+                }
+
+                break;
+
+            case KING | COLOR:
+            case KING:
+
+                genkcap (ORTHOG1);
+                genkcap (ORTHOG2);
+                genkcap (ORTHOG3);
+                genkcap (ORTHOG4);
+                genkcap (DIAG1);
+                genkcap (DIAG2);
+                genkcap (DIAG3);
+                genkcap (DIAG4);
+                break;
+
+            case PAWN | COLOR:
+
+                if (pos->in_check || (*src & PINNED)) {
+                    checkpcap (BPCAP1, BPRANK);
+                    checkpcap (BPCAP2, BPRANK);
+                }
+                else {
+                    genpcap (BPCAP1, BPRANK);
+                    genpcap (BPCAP2, BPRANK);
+                }
+
+                break;
+
+            case PAWN:
+
+                if (pos->in_check || (*src & PINNED)) {
+                    checkpcap (WPCAP1, WPRANK);
+                    checkpcap (WPCAP2, WPRANK);
+                }
+                else {
+                    genpcap (WPCAP1, WPRANK);
+                    genpcap (WPCAP2, WPRANK);
+                }
+
+                break;
+        }
+    }
+
+    while (npins)
+        *pins [--npins] &= ~PINNED;
+
+    return listptr - list;
+}
+
+// These are the versions of the macros above for the moves that don't
+// capture (the rest of the pawn moves use the ones above, which only go to
+// empty squares anyway). A slider stops at the first piece in its path.
+
+#define genquiet(dir)                                   \
+    if (!*(dst = src + (move.delta = dir)))             \
+        *listptr++ = move;                              \
+
+#define checkquiet(dir)                                 \
+    if (!*(dst = src + (move.delta = dir))) {           \
+                                                        \
+        *dst = *src; *src = 0;                          \
+                                                        \
+        if (!in_check (pos))                            \
+            *listptr++ = move;                          \
+                                                        \
+        *src = *dst; *dst = 0;                          \
+    }
+
+#define genquietpath(dir)                               \
+    for (move.delta = dir; !src [move.delta];           \
+        move.delta += dir)                              \
+            *listptr++ = move;                          \
+
+#define checkquietpath(dir)                             \
+    for (move.delta = dir;                              \
+        !*(dst = src + move.delta); move.delta += dir) {\
+                                                        \
+            *dst = *src; *src = 0;                      \
+                                                        \
+            if (!in_check (pos))                        \
+                *listptr++ = move;                      \
+                                                        \
+            *src = *dst; *dst = 0;                      \
+    }
+
+#define genkquiet(dir)                                  \
+    if (!*(dst = src + (move.delta = dir))) {           \
+                                                        \
+        *dst = *src; *src = 0;                          \
+                                                        \
+        if (!check_attack (dst, ~*dst & COLOR))         \
+            *listptr++ = move;                          \
+                                                        \
+        *src = *dst; *dst = 0;                          \
     }
 
-MOVE null_list [MAX_MOVES + 10];
+// Generate just the legal moves that generate_capture_list() leaves out (i.e.,
+// the moves to empty squares, including castling, pawn pushes and promotions,
+// and en passant). These are the same moves, in the same order, that
+// generate_move_list() would produce for those squares, and are what the
+// search generates at nodes where the captures haven't caused a cutoff.
 
-int generate_move_list (MOVE list [], FRAME *frame)
+int generate_quiet_list (MOVE list [], POSITION *pos)
 {
-    square *src, *dst, *cap, capture_temp;
-    MOVE *listptr, move;
-    int rank, file;
+    int color = pos->move_color >> 3, npins = 0, pindex, rank;
+    square *src, *dst, *cap, capture_temp, *pins [8];
+    MOVE local_list [MAX_MOVES + 10], *listptr, move;
 
     if (!list)
-        listptr = list = null_list;
+        listptr = list = local_list;
     else
         listptr = list;
 
-    if (!frame->in_check)
-        set_pinned_status (frame);
+    if (!pos->in_check)
+        npins = set_pinned_status (pos, pins);
 
     move.promo = 0;
 
-    for (rank = 1; rank <= BOARD_SIDE; ++rank)
-        for (file = 1; file <= BOARD_SIDE; ++file) {
-
-            src = &frame->board [move.from = INDEX (rank, file)];
-
-            if ((*src & COLOR) == frame->move_color)
-                switch (*src & (PIECE | COLOR)) {
-
-                    case BISHOP | COLOR:
-                    case QUEEN | COLOR:
-                    case BISHOP:
-                    case QUEEN:
-
-                        if (frame->in_check || (*src & PINNED)) {
-
-                            checkpath (DIAG1);
-                            checkpath (DIAG2);
-                            checkpath (DIAG3);
-                            checkpath (DIAG4);
-                        }
-                        else {
-                            genpath (DIAG1);
-                            genpath (DIAG2);
-                            genpath (DIAG3);
-                            genpath (DIAG4);
-                        }
-
-                        if ((*src & PIECE) == BISHOP)
-                            break;
-
-                    case ROOK | COLOR:
-                    case ROOK:
-
-                        if (frame->in_check || (*src & PINNED)) {
-
-                            checkpath (ORTHOG1);
-                            checkpath (ORTHOG2);
-                            checkpath (ORTHOG3);
-                            checkpath (ORTHOG4);
-                        }
-                        else {
-                            genpath (ORTHOG1);
-                            genpath (ORTHOG2);
-                            genpath (ORTHOG3);
-                            genpath (ORTHOG4);
-                        }
+    for (pindex = 0; pindex < pos->piece_counts [color]; ++pindex) {
 
-                        break;
+        src = &pos->board [move.from = pos->piece_lists [color] [pindex]];
+        rank = move.from / (BOARD_SIDE + 4) - 1;
 
-                    case KNIGHT | COLOR:
-                    case KNIGHT:
-
-                        if (frame->in_check) {
-
-                            checkmove (KNIGHT1);
-                            checkmove (KNIGHT2);
-                            checkmove (KNIGHT3);
-                            checkmove (KNIGHT4);
-                            checkmove (KNIGHT5);
-                            checkmove (KNIGHT6);
-                            checkmove (KNIGHT7);
-                            checkmove (KNIGHT8);
-                        }
-                        else if (!(*src & PINNED)) {
-
-                            genmove (KNIGHT1);
-                            genmove (KNIGHT2);
-                            genmove (KNIGHT3);
-                            genmove (KNIGHT4);
-                            genmove (KNIGHT5);
-                            genmove (KNIGHT6);
-                            genmove (KNIGHT7);
-                            genmove (KNIGHT8);
-                        }
+        switch (*src & (PIECE | COLOR)) {
 
-                        break;
+            case BISHOP | COLOR:
+            case QUEEN | COLOR:
+            case BISHOP:
+            case QUEEN:
+
+                if (pos->in_check || (*src & PINNED)) {
+
+                    checkquietpath (DIAG1);
+                    checkquietpath (DIAG2);
+                    checkquietpath (DIAG3);
+                    checkquietpath (DIAG4);
+                }
+                else {
+                    genquietpath (DIAG1);
+                    genquietpath (DIAG2);
+                    genquietpath (DIAG3);
+                    genquietpath (DIAG4);
+                }
+
+                if ((*src & PIECE) == BISHOP)
+                    break;
 
-                    case KING | COLOR:
-                    case KING:
+            case ROOK | COLOR:
+            case ROOK:
 
-                        genkmove (ORTHOG1);
-                        genkmove (ORTHOG2);
-                        genkmove (ORTHOG3);
-                        genkmove (ORTHOG4);
-                        genkmove (DIAG1);
-                        genkmove (DIAG2);
-                        genkmove (DIAG3);
-                        genkmove (DIAG4);
+                if (pos->in_check || (*src & PINNED)) {
 
-                        if (!frame->in_check && !(*src & MOVED)) {
+                    checkquietpath (ORTHOG1);
+                    checkquietpath (ORTHOG2);
+                    checkquietpath (ORTHOG3);
+                    checkquietpath (ORTHOG4);
+                }
+                else {
+                    genquietpath (ORTHOG1);
+                    genquietpath (ORTHOG2);
+                    genquietpath (ORTHOG3);
+                    genquietpath (ORTHOG4);
+                }
 
-                            if (!src [1] && !src [2] &&
-                                ((src [3] & (PIECE | MOVED)) == ROOK) &&
-                                !check_attack (src + 1, ~*src & COLOR) &&
-                                !check_attack (src + 2, ~*src & COLOR)) {
+                break;
 
-                                    move.delta = KINGOO;
-                                    *listptr++ = move;
-                            }
+            case KNIGHT | COLOR:
+            case KNIGHT:
 
-                            if (!src [-1] && !src [-2] && !src [-3] &&
-                                ((src [-4] & (PIECE | MOVED)) == ROOK) &&
-                                !check_attack (src - 1, ~*src & COLOR) &&
-                                !check_attack (src - 2, ~*src & COLOR)) {
+                if (pos->in_check) {
 
-                                    move.delta = KINGOOO;
-                                    *listptr++ = move;
-                            }
-                        }
+                    checkquiet (KNIGHT1);
+                    checkquiet (KNIGHT2);
+                    checkquiet (KNIGHT3);
+                    checkquiet (KNIGHT4);
+                    checkquiet (KNIGHT5);
+                    checkquiet (KNIGHT6);
+                    checkquiet (KNIGHT7);
+                    checkquiet (KNIGHT8);
+                }
+                else if (!(*src & PINNED)) {
+
+                    genquiet (KNIGHT1);
+                    genquiet (KNIGHT2);
+                    genquiet (KNIGHT3);
+                    genquiet (KNIGHT4);
+                    genquiet (KNIGHT5);
+                    genquiet (KNIGHT6);
+                    genquiet (KNIGHT7);
+                    genquiet (KNIGHT8);
+                }
 
-                        break;
+                break;
 
-                    case PAWN | COLOR:
-
-                        if (frame->in_check || (*src & PINNED)) {
-                            checkpmove (BPAWN1, BPRANK);
-                            checkpcap (BPCAP1, BPRANK);
-                            checkpcap (BPCAP2, BPRANK);
-                        }
-                        else {
-                            genpmove (BPAWN1, BPRANK);
-                            genpcap (BPCAP1, BPRANK);
-                            genpcap (BPCAP2, BPRANK);
-                        }
-
-                        genpepx (BPCAP1, BPEPX1, frame->white_epsquare);
-                        genpepx (BPCAP2, BPEPX2, frame->white_epsquare);
-                        break;
+            case KING | COLOR:
+            case KING:
 
-                    case PAWN:
-
-                        if (frame->in_check || (*src & PINNED)) {
-                            checkpmove (WPAWN1, WPRANK);
-                            checkpcap (WPCAP1, WPRANK);
-                            checkpcap (WPCAP2, WPRANK);
-                        }
-                        else {
-                            genpmove (WPAWN1, WPRANK);
-                            genpcap (WPCAP1, WPRANK);
-                            genpcap (WPCAP2, WPRANK);
-                        }
-
-                        genpepx (WPCAP1, WPEPX1, frame->black_epsquare);
-                        genpepx (WPCAP2, WPEPX2, frame->black_epsquare);
-                        break;
+                genkquiet (ORTHOG1);
+                genkquiet (ORTHOG2);
+                genkquiet (ORTHOG3);
+                genkquiet (ORTHOG4);
+                genkquiet (DIAG1);
+                genkquiet (DIAG2);
+                genkquiet (DIAG3);
+                genkquiet (DIAG4);
+
+                if (!pos->in_check && !(*src & MOVED)) {
+
+                    if (!src [1] && !src [2] &&
+                        ((src [3] & (PIECE | MOVED)) == ROOK) &&
+                        !check_attack (src + 1, ~*src & COLOR) &&
+                        !check_attack (src + 2, ~*src & COLOR)) {
+
+                            move.delta = KINGOO;
+                            *listptr++ = move;
+                    }
+
+                    if (!src [-1] && !src [-2] && !src [-3] &&
+                        ((src [-4] & (PIECE | MOVED)) == ROOK) &&
+                        !check_attack (src - 1, ~*src & COLOR) &&
+                        !check_attack (src - 2, ~*src & COLOR)) {
+
+                            move.delta = KINGOOO;
+                            *listptr++ = move;
+                    }
+                }
+
+                break;
+
+            case PAWN | COLOR:
+
+                if (pos->in_check || (*src & PINNED)) {
+                    checkpmove (BPAWN1, BPRANK);
+                }
+                else {
+                    genpmove (BPAWN1, BPRANK);
+                }
+
+                genpepx (BPCAP1, BPEPX1, pos->white_epsquare);
+                genpepx (BPCAP2, BPEPX2, pos->white_epsquare);
+                break;
+
+            case PAWN:
+
+                if (pos->in_check || (*src & PINNED)) {
+                    checkpmove (WPAWN1, WPRANK);
                 }
+                else {
+                    genpmove (WPAWN1, WPRANK);
+                }
+
+                genpepx (WPCAP1, WPEPX1, pos->black_epsquare);
+                genpepx (WPCAP2, WPEPX2, pos->black_epsquare);
+                break;
         }
+    }
+
+    while (npins)
+        *pins [--npins] &= ~PINNED;
 
     return listptr - list;
 }
 
+#endif
+
 static int piece_value [] = { 0, 0, 1, 0, 3, 3, 5, 9 };
 
+// Execute the specified move in the specified frame. This is for when the
+// move will not be taken back; the search uses make_move() and unmake_move().
+
 void execute_move (FRAME *frame, MOVE *move)
 {
-    square *src = &frame->board [move->from];
+    UNDO undo;
+
+    make_move (frame, move, &undo);
+}
+
+// Make the specified move in the specified frame, saving the information
+// needed to take it back again with unmake_move() in the "undo" record.
+
+void make_move (FRAME *frame, MOVE *move, UNDO *undo)
+{
+    POSITION *pos = &frame->pos;
+    square *src = &pos->board [move->from];
     square *dst = src + move->delta;
     square *cap = dst;
-
-    frame->drawn_game = 0;
+    uint64_t key = pos->key ^ zobrist_color;
+    int castle_change, ply;
+
+    undo->key = pos->key;
+    undo->in_check = pos->in_check;
+    undo->drawn_game = pos->drawn_game;
+    undo->reversable_moves = pos->reversable_moves;
+    undo->white_king = pos->white_king;
+    undo->white_material = pos->white_material;
+    undo->white_pawns = pos->white_pawns;
+    undo->white_epsquare = pos->white_epsquare;
+    undo->black_king = pos->black_king;
+    undo->black_material = pos->black_material;
+    undo->black_pawns = pos->black_pawns;
+    undo->black_epsquare = pos->black_epsquare;
+    undo->moved = *src;
+
+    pos->drawn_game = 0;
 
     if ((*cap & PIECE) == KING) {
         printf ("capturing a king!\n");
         exit (1);
     }
 
+    // castling rights can only change when an unmoved king or rook moves or
+    // an unmoved rook is captured, so only recalculate them in those cases
+
+    castle_change = (*src & (PIECE | MOVED)) == KING || (*src & (PIECE | MOVED)) == ROOK ||
+        (*dst & (PIECE | MOVED)) == ROOK;
+
+    if (castle_change)
+        key ^= zobrist_castle [castle_rights (pos)];
+
+    if (pos->white_epsquare)
+        key ^= zobrist_epsquare [pos->white_epsquare];
+    else if (pos->black_epsquare)
+        key ^= zobrist_epsquare [pos->black_epsquare];
+
     if ((*src & PIECE) == PAWN || *dst)
-        frame->reversable_moves = 0;
+        pos->reversable_moves = 0;
     else
-        ++frame->reversable_moves;
+        ++pos->reversable_moves;
+
+    if ((*src & PIECE) == PAWN && !*cap) {
+
+        if (*src & COLOR) {
+            if (move->delta != BPAWN1 && move->delta != BPAWN2)
+                cap = &pos->board [pos->white_epsquare];
+        }
+        else if (move->delta != WPAWN1 && move->delta != WPAWN2)
+            cap = &pos->board [pos->black_epsquare];
+    }
 
     if ((*src & PIECE) == KING) {
 
         if (move->delta == KINGOO) {
+            key ^= PIECE_KEY (src [3], move->from + 3) ^ PIECE_KEY (src [3], move->from + 1);
+            BB_TOGGLE (pos, src [3], move->from + 3);
+            BB_TOGGLE (pos, src [3], move->from + 1);
+            LIST_MOVE (pos, src [3], move->from + 3, move->from + 1);
             src [1] = src [3] | MOVED;
             src [3] = 0;
         }
         else if (move->delta == KINGOOO) {
+            key ^= PIECE_KEY (src [-4], move->from - 4) ^ PIECE_KEY (src [-4], move->from - 1);
+            BB_TOGGLE (pos, src [-4], move->from - 4);
+            BB_TOGGLE (pos, src [-4], move->from - 1);
+            LIST_MOVE (pos, src [-4], move->from - 4, move->from - 1);
             src [-1] = src [-4] | MOVED;
             src [-4] = 0;
         }
 
         if (*src & COLOR)
-            frame->black_king = move->from + move->delta;
+            pos->black_king = move->from + move->delta;
         else
-            frame->white_king = move->from + move->delta;
+            pos->white_king = move->from + move->delta;
     }
-    else if ((*src & PIECE) == PAWN && !*cap) {
 
-        if (*src & COLOR) {
-            if (move->delta != BPAWN1 && move->delta != BPAWN2)
-                cap = &frame->board [frame->white_epsquare];
-        }
-        else if (move->delta != WPAWN1 && move->delta != WPAWN2)
-            cap = &frame->board [frame->black_epsquare];
-    }
+    undo->cap_index = cap - pos->board;
+    undo->captured = *cap;
 
     if ((*src & PIECE) == PAWN && (*src & COLOR) && move->delta == BPAWN2)
-        frame->black_epsquare = move->from + move->delta;
+        key ^= zobrist_epsquare [pos->black_epsquare = move->from + move->delta];
     else
-        frame->black_epsquare = 0;
+        pos->black_epsquare = 0;
 
     if ((*src & PIECE) == PAWN && !(*src & COLOR) && move->delta == WPAWN2)
-        frame->white_epsquare = move->from + move->delta;
+        key ^= zobrist_epsquare [pos->white_epsquare = move->from + move->delta];
     else
-        frame->white_epsquare = 0;
+        pos->white_epsquare = 0;
 
     if (*cap) {
+        key ^= PIECE_KEY (*cap, cap - pos->board);
+        BB_TOGGLE (pos, *cap, cap - pos->board);
+        undo->cap_slot = pos->list_index [cap - pos->board];
+        LIST_REMOVE (pos, *cap, cap - pos->board);
+
         if (*cap & COLOR) {
-            frame->black_material -= piece_value [*cap & PIECE];
+            pos->black_material -= piece_value [*cap & PIECE];
 
             if ((*cap & PIECE) == PAWN)
-                frame->black_pawns--;
+                pos->black_pawns--;
         }
         else {
-            frame->white_material -= piece_value [*cap & PIECE];
+            pos->white_material -= piece_value [*cap & PIECE];
 
             if ((*cap & PIECE) == PAWN)
-                frame->white_pawns--;
+                pos->white_pawns--;
         }
 
         *cap = 0;
@@ -777,104 +3138,662 @@ void execute_move (FRAME *frame, MOVE *move)
 
     if (move->promo) {
         if ((*dst = move->promo | (*src & COLOR) | MOVED) & COLOR) {
-            (frame->black_material += piece_value [*dst & PIECE] - 1);
-            frame->black_pawns--;
+            (pos->black_material += piece_value [*dst & PIECE] - 1);
+            pos->black_pawns--;
         }
         else {
-            (frame->white_material += piece_value [*dst & PIECE] - 1);
-            frame->white_pawns--;
+            (pos->white_material += piece_value [*dst & PIECE] - 1);
+            pos->white_pawns--;
         }
     }
     else
         *dst = *src | MOVED;
 
+    key ^= PIECE_KEY (*src, move->from) ^ PIECE_KEY (*dst, move->from + move->delta);
+    BB_TOGGLE (pos, *src, move->from);
+    BB_TOGGLE (pos, *dst, move->from + move->delta);
+    LIST_MOVE (pos, *src, move->from, move->from + move->delta);
     *src = 0;
 
-    if (!(frame->move_color ^= COLOR))
-        ++frame->move_number;
+    if (castle_change)
+        key ^= zobrist_castle [castle_rights (pos)];
+
+    if (!(pos->move_color ^= COLOR))
+        ++pos->move_number;
 
-    frame->in_check = in_check (frame);
+    pos->in_check = in_check (pos);
+    pos->key = key;
 
-    if (frame->reversable_moves < MAX_POS_IDS) {
+    // because the key includes the side to move, only every other previous
+    // position (since the last irreversible move) can possibly be a repeat
 
-        int pindex, repeat, pos = position_id (frame);
+    HISTORY_KEY (frame, ply = PLY (pos)) = key;
 
-        frame->position_ids [frame->reversable_moves] = pos;
+    if (pos->reversable_moves < MAX_POS_IDS) {
 
-        for (repeat = pindex = 0; pindex < frame->reversable_moves; ++pindex)
-            if (frame->position_ids [pindex] == pos)
+        int pindex, repeat = 0;
+
+        for (pindex = 4; pindex <= pos->reversable_moves; pindex += 2)
+            if (HISTORY_KEY (frame, ply - pindex) == key)
                 ++repeat;
 
         if (repeat >= 2)
-            frame->drawn_game = POSITION_3X;
+            pos->drawn_game = POSITION_3X;
     }
-    else if (!frame->in_check || generate_move_list (NULL, frame))
-        frame->drawn_game = MOVES_OVER_50;
+    else if (!pos->in_check || generate_move_list (NULL, pos))
+        pos->drawn_game = MOVES_OVER_50;
 
-    if (!frame->white_pawns && frame->white_material < 5 &&
-        !frame->black_pawns && frame->black_material < 5)
-            frame->drawn_game = NO_MATE_POWER;
+    if (!pos->white_pawns && pos->white_material < 5 &&
+        !pos->black_pawns && pos->black_material < 5)
+            pos->drawn_game = NO_MATE_POWER;
 }
 
-static int sum_material (FRAME *frame, int color)
+// Take back the specified move (which must be the last one made in this
+// frame with make_move()) using the information saved in the "undo" record.
+// Note that a castling rook can't have moved before, so no need to save it.
+
+void unmake_move (FRAME *frame, MOVE *move, UNDO *undo)
 {
-    int rank, file, sum = 0;
+    POSITION *pos = &frame->pos;
+    square *src = &pos->board [move->from];
+
+    if (!pos->move_color)
+        --pos->move_number;
+
+    pos->move_color ^= COLOR;
+
+    BB_TOGGLE (pos, src [move->delta], move->from + move->delta);
+    BB_TOGGLE (pos, undo->moved, move->from);
+    LIST_MOVE (pos, undo->moved, move->from + move->delta, move->from);
+
+    if (undo->captured) {
+        BB_TOGGLE (pos, undo->captured, undo->cap_index);
+        LIST_RESTORE (pos, undo->captured, undo->cap_index, undo->cap_slot);
+    }
+
+    if ((undo->moved & PIECE) == KING) {
+
+        if (move->delta == KINGOO) {
+            BB_TOGGLE (pos, src [1], move->from + 1);
+            BB_TOGGLE (pos, src [1], move->from + 3);
+            LIST_MOVE (pos, src [1], move->from + 1, move->from + 3);
+            src [3] = src [1] & ~MOVED;
+            src [1] = 0;
+        }
+        else if (move->delta == KINGOOO) {
+            BB_TOGGLE (pos, src [-1], move->from - 1);
+            BB_TOGGLE (pos, src [-1], move->from - 4);
+            LIST_MOVE (pos, src [-1], move->from - 1, move->from - 4);
+            src [-4] = src [-1] & ~MOVED;
+            src [-1] = 0;
+        }
+    }
+
+    src [move->delta] = 0;
+    pos->board [undo->cap_index] = undo->captured;
+    *src = undo->moved;
+
+    pos->key = undo->key;
+    pos->in_check = undo->in_check;
+    pos->drawn_game = undo->drawn_game;
+    pos->reversable_moves = undo->reversable_moves;
+    pos->white_king = undo->white_king;
+    pos->white_material = undo->white_material;
+    pos->white_pawns = undo->white_pawns;
+    pos->white_epsquare = undo->white_epsquare;
+    pos->black_king = undo->black_king;
+    pos->black_material = undo->black_material;
+    pos->black_pawns = undo->black_pawns;
+    pos->black_epsquare = undo->black_epsquare;
+}
+
+// Count the leaf nodes of the legal move tree to the specified depth from the
+// specified position (i.e., "perft"). This only exercises the move generator
+// and execute_move() so it's useful for both verification and benchmarking.
+// With "bulk" set the moves at the last ply are counted but not executed.
+
+long long perft (FRAME *frame, int depth, int bulk)
+{
+    MOVE moves [MAX_MOVES + 10];
+    long long nodes = 0;
+    int nmoves, mindex;
+    UNDO undo;
+
+    if (depth <= 0)
+        return 1;
+
+    nmoves = generate_move_list (moves, &frame->pos);
+
+    if (bulk && depth == 1)
+        return nmoves;
+
+    for (mindex = 0; mindex < nmoves; ++mindex) {
+        make_move (frame, moves + mindex, &undo);
+        nodes += perft (frame, depth - 1, bulk);
+        unmake_move (frame, moves + mindex, &undo);
+    }
+
+    return nodes;
+}
+
+typedef struct {
+    FRAME *frame;
+    MOVE *moves;
+    long long *counts;
+    int depth, bulk;
+} PERFT_JOB;
+
+static void perft_job (void *context, int mindex)
+{
+    PERFT_JOB *job = (PERFT_JOB *) context;
+    FRAME temp = *job->frame;
+    uint64_t history [MAX_HISTORY];
+
+    fork_history (&temp, history);
+
+    execute_move (&temp, job->moves + mindex);
+    job->counts [mindex] = perft (&temp, job->depth - 1, job->bulk);
+}
+
+// Generate the legal moves for the specified position and count the leaf
+// nodes under each of them to the specified depth (i.e., "divide"). The root
+// moves are split between the threads of the pool if frame->max_threads > 1.
+// Returns the number of root moves (with their counts in the "counts" array).
+
+int perft_divide (FRAME *frame, int depth, int bulk, MOVE moves [], long long counts [])
+{
+    int nmoves, mindex;
+    PERFT_JOB job;
+
+    if (depth < 1)
+        return 0;
+
+    nmoves = generate_move_list (moves, &frame->pos);
+    job.frame = frame;
+    job.moves = moves;
+    job.counts = counts;
+    job.depth = depth;
+    job.bulk = bulk;
+
+    if (frame->max_threads > 1)
+        run_parallel (perft_job, &job, nmoves);
+    else
+        for (mindex = 0; mindex < nmoves; ++mindex)
+            perft_job (&job, mindex);
+
+    return nmoves;
+}
+
+// Build the piece lists of the specified position from its board array (in
+// board order). This must be called whenever the board is set up from scratch.
+
+static void init_piece_lists (POSITION *pos)
+{
+    int rank, file;
+
+    pos->piece_counts [0] = pos->piece_counts [1] = 0;
 
     for (rank = 1; rank <= BOARD_SIDE; ++rank)
         for (file = 1; file <= BOARD_SIDE; ++file)
-            if ((SQUARE (frame, rank, file) & COLOR) == color)
-                sum += piece_value [SQUARE (frame, rank, file) & PIECE];
+            if (SQUARE (pos, rank, file) & PIECE) {
+                int color = (SQUARE (pos, rank, file) & COLOR) >> 3;
+
+                pos->list_index [INDEX (rank, file)] = pos->piece_counts [color];
+                pos->piece_lists [color] [pos->piece_counts [color]++] = INDEX (rank, file);
+            }
+}
+
+static int sum_material (POSITION *pos, int color)
+{
+    int pindex, sum = 0;
+
+    for (pindex = 0; pindex < pos->piece_counts [color >> 3]; ++pindex)
+        sum += piece_value [pos->board [pos->piece_lists [color >> 3] [pindex]] & PIECE];
 
     return sum;
 }
 
-static int count_pawns (FRAME *frame, int color)
+static int count_pawns (POSITION *pos, int color)
 {
-    int rank, file, sum = 0;
+    int pindex, sum = 0;
 
-    for (rank = 1; rank <= BOARD_SIDE; ++rank)
-        for (file = 1; file <= BOARD_SIDE; ++file)
-            if ((SQUARE (frame, rank, file) & (PIECE | COLOR)) ==
-                (PAWN | color))
-                    ++sum;
+    for (pindex = 0; pindex < pos->piece_counts [color >> 3]; ++pindex)
+        if ((pos->board [pos->piece_lists [color >> 3] [pindex]] & PIECE) == PAWN)
+            ++sum;
 
     return sum;
 }
 
-static int count_center_pawns (FRAME *frame, int color)
+static int count_center_pawns (POSITION *pos, int color)
 {
     int rank, file, sum = 0;
 
     for (rank = BOARD_SIDE / 2; rank <= (BOARD_SIDE + 3) / 2; ++rank)
         for (file = BOARD_SIDE / 2; file <= (BOARD_SIDE + 3) / 2; ++file)
-            if ((SQUARE (frame, rank, file) & (PIECE | COLOR)) ==
+            if ((SQUARE (pos, rank, file) & (PIECE | COLOR)) ==
                 (PAWN | color))
                     ++sum;
 
     return sum;
 }
 
-static void scramble_moves (MOVE moves [], int nmoves)
+// Count the mobility of the specified color for the EVAL_POSITION evaluation:
+// the number of squares its pieces attack that aren't occupied by its own
+// pieces (a slider's attacks stop at the first piece in its path). Nothing is
+// checked for legality, so this is much cheaper than generating the moves.
+
+#ifndef BITBOARDS
+
+#define countstep(dst)                                                  \
+    mobility += (!(*(dst) & BORDER)) & ((!(*(dst) & PIECE)) | ((*(dst) & COLOR) != color));
+
+#define countpath(dir)                                                  \
+    for (dst = src + (dir); !*dst; dst += (dir))                        \
+        ++mobility;                                                     \
+                                                                        \
+    countstep (dst);
+
+#endif
+
+static int count_mobility (POSITION *pos, int color)
+{
+#ifdef BITBOARDS
+    return bb_mobility (pos, color);
+#else
+    int pindex, mobility = 0;
+    square *src, *dst;
+
+    for (pindex = 0; pindex < pos->piece_counts [color >> 3]; ++pindex) {
+
+        src = &pos->board [pos->piece_lists [color >> 3] [pindex]];
+
+        switch (*src & PIECE) {
+
+            case PAWN:
+                countstep (src + (color ? BPCAP1 : WPCAP1));
+                countstep (src + (color ? BPCAP2 : WPCAP2));
+                break;
+
+            case KNIGHT:
+                countstep (src + KNIGHT1);
+                countstep (src + KNIGHT2);
+                countstep (src + KNIGHT3);
+                countstep (src + KNIGHT4);
+                countstep (src + KNIGHT5);
+                countstep (src + KNIGHT6);
+                countstep (src + KNIGHT7);
+                countstep (src + KNIGHT8);
+                break;
+
+            case KING:
+                countstep (src + ORTHOG1);
+                countstep (src + ORTHOG2);
+                countstep (src + ORTHOG3);
+                countstep (src + ORTHOG4);
+                countstep (src + DIAG1);
+                countstep (src + DIAG2);
+                countstep (src + DIAG3);
+                countstep (src + DIAG4);
+                break;
+
+            case BISHOP:
+            case QUEEN:
+                countpath (DIAG1);
+                countpath (DIAG2);
+                countpath (DIAG3);
+                countpath (DIAG4);
+
+                if ((*src & PIECE) == BISHOP)
+                    break;
+
+            case ROOK:
+                countpath (ORTHOG1);
+                countpath (ORTHOG2);
+                countpath (ORTHOG3);
+                countpath (ORTHOG4);
+                break;
+        }
+    }
+
+    return mobility;
+#endif
+}
+
+// Shuffle the moves using the searching thread's own random sequence (so
+// that moves that are ordered the same are tried in random order). There's
+// no sequence to use if there are no thread states (i.e., no thread pool).
+
+static void scramble_moves (FRAME *frame, MOVE moves [], int nmoves)
 {
+    unsigned int *seed;
     int mindex, rindex;
     MOVE temp;
 
+    if (!thread_states)
+        return;
+
+    seed = &thread_states [frame->thread_index].random_seed;
+
     for (mindex = 0; mindex < nmoves; ++mindex) {
-        random_seed = ((random_seed << 4) - random_seed) ^ 1;
-        rindex = (random_seed >> 17) % nmoves;
+        *seed = ((*seed << 4) - *seed) ^ 1;
+        rindex = (*seed >> 17) % nmoves;
         temp = moves [rindex];
         moves [rindex] = moves [mindex];
         moves [mindex] = temp;
     }
 }
 
-static int position_id (FRAME *frame)
+// Sort the specified moves into the order they should be searched: the move
+// from the transposition table (if any) first, then captures with the most
+// valuable victims first (and of those, with the least valuable attackers
+// first), then promotions, then the killers for this ply and the refutation
+// of the last move, and then the other quiet moves by their history scores.
+// The sort is stable, so moves that score the same stay in the order they
+// were in.
+
+static int order_value [] = { 0, 0, 1, 10, 3, 3, 5, 9 };
+
+#define ORDER_HASH      (1 << 30)
+#define ORDER_CAPTURE   (1 << 29)
+#define ORDER_PROMO     (1 << 28)
+#define ORDER_KILLER    (1 << 27)
+
+static void order_moves (FRAME *frame, MOVE moves [], int nmoves, MOVE *hashmove)
 {
-    int rank, file, sum = 0;
+    MOVE *killers = NULL, *countermove = NULL;
+    int scores [MAX_MOVES + 10], mindex, sindex;
+    POSITION *pos = &frame->pos;
+    THREAD_STATE *tables = NULL;
+
+    if (thread_states) {
+        tables = thread_states + frame->thread_index;
+        killers = tables->killers [PLY (pos) & (MAX_HISTORY - 1)];
+
+        if (frame->last_to)
+            countermove = &tables->countermoves [pos->board [frame->last_to] & (PIECE | COLOR)] [frame->last_to];
+    }
+
+    for (mindex = 0; mindex < nmoves; ++mindex) {
+        MOVE *move = moves + mindex;
+        square piece = pos->board [move->from], victim = pos->board [move->from + move->delta];
+
+        if ((piece & PIECE) == PAWN && !victim && (move->delta & 1))
+            victim = PAWN;      // en passant
+
+        if (hashmove->from && SAME_MOVE (*move, *hashmove))
+            scores [mindex] = ORDER_HASH;
+        else if (victim)
+            scores [mindex] = ORDER_CAPTURE + order_value [victim & PIECE] * 16 - order_value [piece & PIECE] + order_value [move->promo];
+        else if (move->promo)
+            scores [mindex] = ORDER_PROMO + order_value [move->promo];
+        else if (!tables)
+            scores [mindex] = 0;
+        else if (SAME_MOVE (*move, killers [0]))
+            scores [mindex] = ORDER_KILLER + 2;
+        else if (SAME_MOVE (*move, killers [1]))
+            scores [mindex] = ORDER_KILLER + 1;
+        else if (countermove && SAME_MOVE (*move, *countermove))
+            scores [mindex] = ORDER_KILLER;
+        else
+            scores [mindex] = tables->history [move->from] [move->from + move->delta];
+    }
+
+    for (mindex = 1; mindex < nmoves; ++mindex) {
+        int score = scores [mindex];
+        MOVE move = moves [mindex];
+
+        for (sindex = mindex; sindex && scores [sindex - 1] < score; --sindex) {
+            scores [sindex] = scores [sindex - 1];
+            moves [sindex] = moves [sindex - 1];
+        }
+
+        scores [sindex] = score;
+        moves [sindex] = move;
+    }
+}
+
+// Add the moves that generate_capture_list() leaves out (quiet moves, promotions
+// that don't capture, and en passant captures) after the specified number of
+// captures already in moves [] (and already searched), and order just those.
+// Returns the new total.
+
+static int add_quiet_moves (FRAME *frame, MOVE moves [], int ncaptures, MOVE *hashmove)
+{
+    int nmoves = ncaptures + generate_quiet_list (moves + ncaptures, &frame->pos);
+
+    if (frame->flags & EVAL_SCRAMBLE)
+        scramble_moves (frame, moves + ncaptures, nmoves - ncaptures);
+
+    order_moves (frame, moves + ncaptures, nmoves - ncaptures, hashmove);
+    return nmoves;
+}
+
+// Remember the specified move (which caused a cutoff at the specified node)
+// in the thread's move tables, if it's a quiet move.
+
+static void record_cutoff (FRAME *frame, MOVE *move)
+{
+    POSITION *pos = &frame->pos;
+    int to = move->from + move->delta, from, dest;
+    THREAD_STATE *tables;
+    MOVE *killers;
+
+    if (!thread_states || !is_quiet (pos, move))
+        return;
+
+    tables = thread_states + frame->thread_index;
+    killers = tables->killers [PLY (pos) & (MAX_HISTORY - 1)];
+
+    if (!SAME_MOVE (*move, killers [0])) {
+        killers [1] = killers [0];
+        killers [0] = *move;
+    }
+
+    if (frame->last_to)
+        tables->countermoves [pos->board [frame->last_to] & (PIECE | COLOR)] [frame->last_to] = *move;
+
+    if (frame->depth > 0 && (tables->history [move->from] [to] += frame->depth * frame->depth) > HISTORY_MAX)
+        for (from = 0; from < (BOARD_SIDE + 4) * (BOARD_SIDE + 4); ++from)
+            for (dest = 0; dest < (BOARD_SIDE + 4) * (BOARD_SIDE + 4); ++dest)
+                tables->history [from] [dest] >>= 1;
+}
+
+// Get the move tables of the thread states in a search's team ready for it
+// (see above); this is done before the search starts, so no other thread is
+// using them.
+
+static void age_move_tables (SEARCH_TEAM *team)
+{
+    int from, dest, mindex;
+
+    if (!thread_states || team->members [0] >= num_thread_states)
+        return;
+
+    for (mindex = 0; mindex < team->nmembers; ++mindex) {
+        THREAD_STATE *tables = thread_states + team->members [mindex];
+
+        memset (tables->killers, 0, sizeof (tables->killers));
+        memset (tables->countermoves, 0, sizeof (tables->countermoves));
+
+        for (from = 0; from < (BOARD_SIDE + 4) * (BOARD_SIDE + 4); ++from)
+            for (dest = 0; dest < (BOARD_SIDE + 4) * (BOARD_SIDE + 4); ++dest)
+                tables->history [from] [dest] >>= 1;
+    }
+}
+
+// Look up the specified position in the transposition table. If found, the
+// stored best move (if any) is returned in "hashmove" and, if the entry was
+// searched deep enough to be used in place of searching this node, TRUE is
+// returned with the score (from the perspective of the side to move) in
+// "score". Bounds are only usable if they're outside the node's window.
+
+static int probe_hash (FRAME *frame, MOVE *hashmove, int *score)
+{
+    HASH_TABLE *table = FRAME_HASH (frame);
+    HASH_ENTRY *entry;
+    int eindex;
+
+    if (!table->entries)
+        return FALSE;
+
+    entry = table->entries + (frame->pos.key & table->mask) * HASH_BUCKET;
+
+    for (eindex = 0; eindex < HASH_BUCKET; ++eindex, ++entry) {
+        uint64_t data = entry->data;
+
+        if ((entry->check ^ data) != frame->pos.key)
+            continue;
+
+        if ((hashmove->from = HASH_FROM (data)) != 0) {
+            hashmove->delta = HASH_DELTA (data);
+            hashmove->promo = HASH_PROMO (data);
+        }
+
+        if (HASH_DEPTH (data) < frame->depth)
+            return FALSE;
+
+        *score = HASH_SCORE (data);
+
+        if (HASH_BOUND (data) == HASH_EXACT)
+            return TRUE;
+
+        if (!(frame->flags & EVAL_PRUNE))
+            return FALSE;
+
+        if (HASH_BOUND (data) == HASH_LOWER)
+            return *score >= node_beta (frame);
+
+        return *score <= frame->alpha;
+    }
+
+    return FALSE;
+}
+
+// Store the result of searching the specified position in the transposition
+// table, replacing either the entry for the same position or the entry in the
+// bucket that is least valuable (with older searches counting as shallower).
+
+static void store_hash (FRAME *frame, MOVE *bestmove, int score, int bound)
+{
+    HASH_TABLE *table = FRAME_HASH (frame);
+    int generation = __atomic_load_n (&table->generation, __ATOMIC_RELAXED) & 0x3f;
+    HASH_ENTRY *entry, *replace = NULL;
+    int eindex, replace_value = 0;
+    uint64_t data;
+
+    if (!table->entries)
+        return;
+
+    entry = table->entries + (frame->pos.key & table->mask) * HASH_BUCKET;
+
+    for (eindex = 0; eindex < HASH_BUCKET; ++eindex, ++entry) {
+        uint64_t edata = entry->data;
+        int value;
+
+        if ((entry->check ^ edata) == frame->pos.key) {
+            if (HASH_DEPTH (edata) > frame->depth && HASH_AGE (edata) == generation)
+                return;
+
+            replace = entry;
+            break;
+        }
+
+        value = HASH_DEPTH (edata) - ((generation - HASH_AGE (edata)) & 0x3f) * 4;
+
+        if (!replace || value < replace_value) {
+            replace_value = value;
+            replace = entry;
+        }
+    }
+
+    data = (uint64_t) (score + 0x8000) | (uint64_t) frame->depth << 16 | (uint64_t) bound << 24 |
+        (uint64_t) generation << 26;
+
+    if (bestmove && bestmove->from)
+        data |= (uint64_t) bestmove->from << 32 | (uint64_t) (bestmove->delta + 0x80) << 40 |
+            (uint64_t) bestmove->promo << 48;
+
+    replace->check = frame->pos.key ^ data;
+    replace->data = data;
+}
+
+// Calculate the Zobrist key of the specified position from scratch; this is
+// only needed when setting up a position because execute_move() maintains the
+// key incrementally from there.
+
+static uint64_t position_key (POSITION *pos)
+{
+    uint64_t key = zobrist_castle [castle_rights (pos)];
+    int rank, file;
 
     for (rank = 1; rank <= BOARD_SIDE; ++rank)
         for (file = 1; file <= BOARD_SIDE; ++file)
-            sum += (sum << 1) + (SQUARE (frame, rank, file) & (PIECE | COLOR));
+            if (SQUARE (pos, rank, file) & PIECE)
+                key ^= PIECE_KEY (SQUARE (pos, rank, file), INDEX (rank, file));
 
-    return sum;
+    if (pos->white_epsquare)
+        key ^= zobrist_epsquare [pos->white_epsquare];
+    else if (pos->black_epsquare)
+        key ^= zobrist_epsquare [pos->black_epsquare];
+
+    if (pos->move_color)
+        key ^= zobrist_color;
+
+    return key;
+}
+
+// Return the castling rights of the specified position (a bit for each side
+// of each color) as implied by the unmoved kings and rooks on the board.
+
+static int castle_rights (POSITION *pos)
+{
+    int rights = 0;
+
+    if ((SQUARE (pos, 1, 5) & (PIECE | COLOR | MOVED)) == KING) {
+        if ((SQUARE (pos, 1, BOARD_SIDE) & (PIECE | COLOR | MOVED)) == ROOK)
+            rights |= 1;
+
+        if ((SQUARE (pos, 1, 1) & (PIECE | COLOR | MOVED)) == ROOK)
+            rights |= 2;
+    }
+
+    if ((SQUARE (pos, BOARD_SIDE, 5) & (PIECE | COLOR | MOVED)) == (KING | COLOR)) {
+        if ((SQUARE (pos, BOARD_SIDE, BOARD_SIDE) & (PIECE | COLOR | MOVED)) == (ROOK | COLOR))
+            rights |= 4;
+
+        if ((SQUARE (pos, BOARD_SIDE, 1) & (PIECE | COLOR | MOVED)) == (ROOK | COLOR))
+            rights |= 8;
+    }
+
+    return rights;
+}
+
+static uint64_t next_key (uint64_t *seed)
+{
+    uint64_t z = (*seed += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Fill the Zobrist key tables using a fixed-seed 64-bit generator (splitmix64)
+// so that keys are reproducible from run to run. Called once via pthread_once().
+
+static void init_zobrist (void)
+{
+    uint64_t seed = 0x46415354ULL;
+    int piece, index;
+
+    for (piece = 0; piece <= (PIECE | COLOR); ++piece)
+        for (index = 0; index < (BOARD_SIDE + 4) * (BOARD_SIDE + 4); ++index)
+            zobrist_pieces [piece] [index] = next_key (&seed);
+
+    for (index = 0; index < (BOARD_SIDE + 4) * (BOARD_SIDE + 4); ++index)
+        zobrist_epsquare [index] = next_key (&seed);
+
+    for (index = 0; index < 16; ++index)
+        zobrist_castle [index] = next_key (&seed);
+
+    zobrist_color = next_key (&seed);
 }
@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
@@ -54,36 +55,122 @@
 #define EVAL_PRUNE      0x4
 #define EVAL_SCALE      0x8
 #define EVAL_DECAY      0x10
+#define EVAL_LAZY_SMP   0x20
+#define EVAL_NULL_MOVE  0x40
+#define EVAL_REDUCE     0x80
+#define EVAL_FUTILITY   0x100
 
 /* internal use only */
-#define EVAL_INTERNAL   0x100
-#define EVAL_PTHREAD    0x200
+#define EVAL_INTERNAL   0x1000
+#define EVAL_PTHREAD    0x2000
 
 typedef unsigned char square;
 
 #define MAX_MATERIAL    55
 #define MAX_MOVES       110
+#define MAX_DEPTH       64
 #define MAX_POS_IDS     50
+#define MAX_HISTORY     256     // must be a power of 2 and > MAX_POS_IDS + search depth
 #define MAX_CAP_POS     2
+#define MAX_FEN         100     // room for any position in Forsyth-Edwards Notation
 
 typedef struct { int from, delta, promo; } MOVE;
 
+// The position itself is kept compact (using small integer fields) so that
+// copying it is cheap. Each side's pieces are also kept in a list so that
+// they can be found without scanning the board. The repetition history is
+// not part of the position; the keys of the positions leading up to it are
+// kept on a separate stack (indexed by ply) that's shared by the frame and
+// everything searched from it.
+
 typedef struct {
-    int move_number, move_color, in_check, drawn_game, reversable_moves, num_cap_pos;
-    int white_king, white_material, white_pawns, white_epsquare;
-    int black_king, black_material, black_pawns, black_epsquare;
+    uint64_t key;
+#ifdef BITBOARDS
+    uint64_t bitboards [2] [PIECE + 1];     // [color] [piece], with [color] [0] all pieces
+#endif
     square board [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
-    int capture_positions [MAX_CAP_POS], position_ids [MAX_POS_IDS];
+    short move_number, reversable_moves;
+    unsigned char move_color, in_check, drawn_game;
+    unsigned char white_king, white_material, white_pawns, white_epsquare;
+    unsigned char black_king, black_material, black_pawns, black_epsquare;
+    unsigned char piece_counts [2], piece_lists [2] [16];   // board indices of each color's pieces
+    unsigned char list_index [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];     // slot in piece_lists []
+} POSITION;
+
+// Optional limits for eval_position(); when a frame has these, the search
+// deepens one ply at a time (up to frame->depth, or as far as it can if that's
+// 0) and returns the result of the last iteration completed before a limit
+// was reached or "stop" was set (which may be done from another thread, and
+// must be cleared by the caller beforehand). The search reports how deep it
+// got and how many nodes it searched, and if "report" is set, calls it after
+// each iteration with the score and principal variation (from the hash table).
+
+typedef struct search_limits {
+    long long max_nodes;                // stop after about this many nodes
+    int move_time;                      // milliseconds to spend on this move
+    int clock_time, clock_increment;    // milliseconds left on our clock, and added per move
+    int moves_to_go;                    // moves until the next time control (0 = unknown)
+    int stop;
+    void (*report) (struct search_limits *limits, int score, MOVE pv [], int pv_length);
+    // filled in by the search...
+    int depth_completed;
+    long long nodes_searched, start_time, stop_time;
+} SEARCH_LIMITS;
+
+// Search statistics, which are only counted in builds with SEARCH_STATS
+// defined (so that normal builds don't pay for them). Each thread counts its
+// own, and at the end of each search eval_position() adds up those of the
+// threads that could have helped in frame->counts_p (if it's set).
+
+#define MAX_CUTOFF_INDEX 8      // cutoffs are counted by move index, the last for any later move
+
+typedef struct {
+    long long interior_nodes, quiesce_nodes;    // full-width nodes and capture-only nodes
+    long long evaluations, move_lists;          // static evaluations and move list generations
+    long long cutoffs [MAX_CUTOFF_INDEX];       // pruning cutoffs, by index of the move that caused it
+    long long null_cutoffs;                     // null move cutoffs
+    long long splits, helps;                    // split points created, and joined by other threads
+    long long idle_usecs, usecs;                // time the threads spent waiting, and time searching
+    int threads, depth;                         // threads that could help, and depth searched
+} SEARCH_COUNTS;
+
+// A transposition table; frames search the one created by init_hash_table()
+// unless given their own (from new_hash_table()) in hash_p.
+
+typedef struct hash_table HASH_TABLE;
+
+typedef struct {
+    POSITION pos;
+    uint64_t *history;
     // for eval_position() parameters and threading...
-    int depth, *min_value_p, flags, max_threads, done;
+    int depth, *min_value_p, alpha, beta, flags, max_threads, thread_index, num_cap_pos;
+    unsigned char capture_positions [MAX_CAP_POS];
     MOVE *bestmove_p, thismove;
-    pthread_mutex_t mutex;
-    pthread_t pthread;
+    struct split_point *split_p;
+    SEARCH_LIMITS *limits_p;
+    HASH_TABLE *hash_p; // transposition table (NULL for the default one)
+#ifdef SEARCH_STATS
+    SEARCH_COUNTS *counts_p;
+#endif
+    int node_count;     // nodes not yet added to limits_p->nodes_searched
+    int last_to;        // destination of the move that led here (0 at the root)
 } FRAME;
 
+// the state that make_move() saves so that unmake_move() can restore it
+
+typedef struct {
+    uint64_t key;
+    short reversable_moves, cap_index;
+    unsigned char in_check, drawn_game;
+    unsigned char white_king, white_material, white_pawns, white_epsquare;
+    unsigned char black_king, black_material, black_pawns, black_epsquare;
+    square moved, captured;
+    unsigned char cap_slot;
+} UNDO;
+
 #define DELTA(rank, file) ((rank) * (BOARD_SIDE + 4) + (file))
 #define INDEX(rank, file) (((rank) + 1) * (BOARD_SIDE + 4) + (file) + 1)
-#define SQUARE(frame, rank, file) ((frame)->board [INDEX ((rank), (file))])
+#define SQUARE(pos, rank, file) ((pos)->board [INDEX ((rank), (file))])
 
 #define DIAG1   (DELTA ( 1, 1))
 #define DIAG2   (DELTA ( 1,-1))
@@ -124,8 +211,35 @@ typedef struct {
 #define WPRANK 2
 #define BPRANK 7
 
-void init_frame (FRAME *frame);
+void init_frame (FRAME *frame, uint64_t history []);
+int init_frame_fen (FRAME *frame, uint64_t history [], const char *fen);
+char *frame_fen (FRAME *frame, char *fen);
+char *move_string (MOVE *move, char *string);
+long long current_millisecs (void);
 void init_random (unsigned int seed);
+int init_hash_table (int megabytes);
+HASH_TABLE *new_hash_table (int megabytes);
+void free_hash_table (HASH_TABLE *table);
+int init_thread_pool (int max_threads);
+int claim_thread_state (void);
+void release_thread_state (int thread_index);
 void *eval_position (void *threadid);
-int generate_move_list (MOVE list [], FRAME *frame);
+void run_parallel (void (*function) (void *context, int index), void *context, int count);
+void eval_positions (int max_threads, int (*next) (void *context, FRAME *frame),
+    void (*done) (void *context, int index, FRAME *frame, int score), void *context);
+int generate_move_list (MOVE list [], POSITION *pos);
+int generate_capture_list (MOVE list [], POSITION *pos);
+int generate_quiet_list (MOVE list [], POSITION *pos);
 void execute_move (FRAME *frame, MOVE *move);
+void make_move (FRAME *frame, MOVE *move, UNDO *undo);
+void unmake_move (FRAME *frame, MOVE *move, UNDO *undo);
+int mate_moves (int score, int pv_length);
+long long perft (FRAME *frame, int depth, int bulk);
+int perft_divide (FRAME *frame, int depth, int bulk, MOVE moves [], long long counts []);
+
+#ifdef BITBOARDS
+extern uint64_t bb_masks [(BOARD_SIDE + 4) * (BOARD_SIDE + 4)];
+void bb_setup (POSITION *pos);
+int bb_in_check (POSITION *pos);
+int bb_mobility (POSITION *pos, int color);
+#endif
@@ -0,0 +1,346 @@
+////////////////////////////////////////////////////////////////////////////
+//                          **** FAST-CHESS ****                          //
+//                     Trivial Chess Playing Program                      //
+//                    Copyright (c) 2020 David Bryant                     //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// libfastchess.c
+
+// The library interface (see libfastchess.h) on top of the engine. All the
+// instances share the engine's thread pool, which is created along with the
+// first instance (with a thread for each processor, or more if that instance
+// asks for more). Each search claims a thread state of its own (see
+// THREAD_STATE in fast-chess.c) with claim_thread_state(), waiting if they're
+// all in use. A multi-threaded search also gets the states for its helpers,
+// up to the instance's thread count, from the ones free when it starts (see
+// SEARCH_TEAM), so searches of different instances never share states and
+// none of them uses more threads than its instance was created with.
+
+#include "fast-chess.h"
+#include "libfastchess.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define DEFAULT_DEPTH   6
+
+// The limits come first so that the search's report() callback can get back
+// to the instance from them. The result of the last iteration reported is
+// kept because it has the principal variation. A stop request is kept apart
+// from the limits (which are cleared when a search is set up) so that one
+// made before the search gets going isn't lost, and the mutex keeps
+// fastchess_stop() from slipping in while the limits are being set up.
+
+struct fastchess {
+    SEARCH_LIMITS limits;
+    FRAME frame;
+    uint64_t history [MAX_HISTORY];
+    MOVE pv [FASTCHESS_MAX_PV];
+    int threads, flags, pv_length, pv_score, stop_requested;
+    pthread_mutex_t mutex;
+};
+
+static void search_report (SEARCH_LIMITS *limits, int score, MOVE pv [], int pv_length);
+static int find_move (FRAME *frame, const char *string, MOVE *move);
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int pool_size;
+
+// Create an engine instance, set to the starting position, that searches
+// with up to the specified number of threads (no more than the pool has) and
+// with its own transposition table of the specified size (0 for none).
+// Returns NULL if the memory could not be allocated.
+
+FASTCHESS *fastchess_create (int threads, int hash_megabytes)
+{
+    FASTCHESS *engine = calloc (1, sizeof (FASTCHESS));
+
+    if (!engine)
+        return NULL;
+
+    if (threads < 1)
+        threads = 1;
+
+    pthread_mutex_lock (&pool_mutex);
+
+    if (!pool_size) {
+#ifdef _WIN32
+        SYSTEM_INFO sysinfo;
+        GetSystemInfo(&sysinfo);
+        int processors = sysinfo.dwNumberOfProcessors;
+#else
+        int processors = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+        pool_size = init_thread_pool (threads > processors ? threads : processors);
+    }
+
+    engine->threads = threads < pool_size ? threads : pool_size;
+    pthread_mutex_unlock (&pool_mutex);
+
+    init_frame (&engine->frame, engine->history);
+
+    if (!(engine->frame.hash_p = new_hash_table (hash_megabytes))) {
+        free (engine);
+        return NULL;
+    }
+
+    pthread_mutex_init (&engine->mutex, NULL);
+
+    // these are the same as the program's defaults, except that the moves
+    // aren't scrambled so that the same search gives the same result
+
+    engine->flags = EVAL_POSITION | EVAL_SCALE | EVAL_PRUNE | EVAL_DECAY |
+        EVAL_NULL_MOVE | EVAL_REDUCE | EVAL_FUTILITY;
+
+    return engine;
+}
+
+// Destroy an instance; it must not be searching.
+
+void fastchess_destroy (FASTCHESS *engine)
+{
+    if (engine) {
+        free_hash_table (engine->frame.hash_p);
+        pthread_mutex_destroy (&engine->mutex);
+        free (engine);
+    }
+}
+
+// Set the position from FEN (or the starting position if "fen" is NULL or
+// "startpos") and then make the moves in "moves" (if not NULL), which are
+// separated by spaces. Returns FALSE (leaving the position unchanged) if the
+// FEN is not valid or any of the moves is illegal.
+
+int fastchess_set_position (FASTCHESS *engine, const char *fen, const char *moves)
+{
+    HASH_TABLE *hash_p = engine->frame.hash_p;
+    uint64_t history [MAX_HISTORY];
+    char string [16];
+    FRAME temp;
+    MOVE move;
+
+    if (!fen || !strcmp (fen, "startpos"))
+        init_frame (&temp, history);
+    else if (!init_frame_fen (&temp, history, fen))
+        return FALSE;
+
+    while (moves && *moves) {
+        int length = 0;
+
+        while (*moves == ' ')
+            moves++;
+
+        while (moves [length] && moves [length] != ' ')
+            length++;
+
+        if (!length)
+            break;
+
+        if (length >= (int) sizeof (string))
+            return FALSE;
+
+        memcpy (string, moves, length);
+        string [length] = '\0';
+        moves += length;
+
+        if (!find_move (&temp, string, &move))
+            return FALSE;
+
+        execute_move (&temp, &move);
+    }
+
+    engine->frame = temp;
+    engine->frame.history = engine->history;
+    engine->frame.hash_p = hash_p;
+    memcpy (engine->history, history, sizeof (history));
+    return TRUE;
+}
+
+// Write the current position in FEN to "fen", which must have room for at
+// least FASTCHESS_MAX_FEN characters, and return it.
+
+char *fastchess_get_position (FASTCHESS *engine, char *fen)
+{
+    return frame_fen (&engine->frame, fen);
+}
+
+// Write the legal moves in the current position to "moves", which must have
+// room for FASTCHESS_MAX_MOVES of them, and return how many there are.
+
+int fastchess_legal_moves (FASTCHESS *engine, char moves [] [6])
+{
+    MOVE list [MAX_MOVES + 10];
+    int nmoves, mindex;
+
+    nmoves = generate_move_list (list, &engine->frame.pos);
+
+    for (mindex = 0; mindex < nmoves; ++mindex)
+        move_string (list + mindex, moves [mindex]);
+
+    return nmoves;
+}
+
+// Make the specified move, returning FALSE (without doing anything) if it's
+// not legal in the current position.
+
+int fastchess_make_move (FASTCHESS *engine, const char *string)
+{
+    MOVE move;
+
+    if (!find_move (&engine->frame, string, &move))
+        return FALSE;
+
+    execute_move (&engine->frame, &move);
+    return TRUE;
+}
+
+// Return whether the game is over in the current position, and if so how
+// (see FASTCHESS_PLAYING, etc.).
+
+int fastchess_status (FASTCHESS *engine)
+{
+    POSITION *pos = &engine->frame.pos;
+
+    if (!generate_move_list (NULL, pos))
+        return pos->in_check ? FASTCHESS_CHECKMATE : FASTCHESS_STALEMATE;
+
+    return pos->drawn_game ? FASTCHESS_DRAW : FASTCHESS_PLAYING;
+}
+
+// Search the current position with the specified limits (or NULL for the
+// default depth) and fill in the result. The engine doesn't pick a move in
+// a position it considers drawn, so the first legal move is returned then.
+// This waits for a thread state if they're all in use, and a multi-threaded
+// search is helped by as many threads (up to the instance's count) as there
+// are states free when it starts. A stop requested before the search starts
+// applies to it, and any stop request is used up when it returns. Returns
+// FALSE if there are no legal moves.
+
+int fastchess_search (FASTCHESS *engine, const FASTCHESS_LIMITS *limits, FASTCHESS_RESULT *result)
+{
+    FASTCHESS_LIMITS none = { 0 };
+    long long start_time = current_millisecs ();
+    MOVE bestmove, moves [MAX_MOVES + 10];
+    FRAME *frame = &engine->frame;
+    char *cptr = result->pv;
+    int score, pindex;
+
+    if (!limits)
+        limits = &none;
+
+    pthread_mutex_lock (&engine->mutex);
+    memset (&engine->limits, 0, sizeof (engine->limits));
+    engine->limits.move_time = limits->move_time;
+    engine->limits.clock_time = limits->clock_time;
+    engine->limits.clock_increment = limits->clock_increment;
+    engine->limits.moves_to_go = limits->moves_to_go;
+    engine->limits.max_nodes = limits->max_nodes;
+    engine->limits.report = search_report;
+    engine->limits.stop = engine->stop_requested;
+    pthread_mutex_unlock (&engine->mutex);
+    engine->pv_length = 0;
+
+    frame->depth = limits->depth;
+
+    if (!limits->depth && !limits->move_time && !limits->clock_time && !limits->max_nodes)
+        frame->depth = DEFAULT_DEPTH;
+
+    frame->flags = engine->flags;
+    frame->limits_p = &engine->limits;
+    frame->bestmove_p = &bestmove;
+    bestmove.from = 0;
+
+    frame->thread_index = claim_thread_state ();
+    frame->max_threads = engine->threads;
+    score = (int) (long) eval_position (frame);
+    release_thread_state (frame->thread_index);
+    frame->limits_p = NULL;
+
+    pthread_mutex_lock (&engine->mutex);
+    engine->stop_requested = FALSE;
+    pthread_mutex_unlock (&engine->mutex);
+
+    if (!bestmove.from && generate_move_list (moves, &frame->pos))
+        bestmove = moves [0];
+
+    if (bestmove.from)
+        move_string (&bestmove, result->bestmove);
+    else
+        result->bestmove [0] = '\0';
+
+    if (engine->pv_length)
+        score = engine->pv_score;
+
+    result->mate = mate_moves (score, engine->pv_length);
+    result->score = result->mate ? 0 : score * 10;
+
+    result->depth = engine->limits.depth_completed;
+    result->nodes = engine->limits.nodes_searched;
+    result->millisecs = current_millisecs () - start_time;
+
+    for (*cptr = '\0', pindex = 0; pindex < engine->pv_length; ++pindex) {
+        if (pindex)
+            *cptr++ = ' ';
+
+        cptr += strlen (move_string (engine->pv + pindex, cptr));
+    }
+
+    return bestmove.from != 0;
+}
+
+// Stop the instance's search, which then returns the result of the last
+// iteration it completed. This can be called from any thread, at any time,
+// and if the instance isn't searching yet its next search is stopped as
+// soon as it starts (so a stop sent while a search is starting up isn't
+// lost).
+
+void fastchess_stop (FASTCHESS *engine)
+{
+    pthread_mutex_lock (&engine->mutex);
+    engine->stop_requested = TRUE;
+    __atomic_store_n (&engine->limits.stop, TRUE, __ATOMIC_RELAXED);
+    pthread_mutex_unlock (&engine->mutex);
+}
+
+static void search_report (SEARCH_LIMITS *limits, int score, MOVE pv [], int pv_length)
+{
+    FASTCHESS *engine = (FASTCHESS *) limits;
+
+    if (pv_length > FASTCHESS_MAX_PV)
+        pv_length = FASTCHESS_MAX_PV;
+
+    memcpy (engine->pv, pv, pv_length * sizeof (MOVE));
+    engine->pv_length = pv_length;
+    engine->pv_score = score;
+}
+
+// Find the legal move in the frame's position that's written as "string",
+// returning FALSE if there isn't one.
+
+static int find_move (FRAME *frame, const char *string, MOVE *move)
+{
+    MOVE moves [MAX_MOVES + 10];
+    char legal [6], lower [6];
+    int nmoves, mindex;
+
+    for (mindex = 0; mindex < 5 && string [mindex]; ++mindex)
+        lower [mindex] = tolower (string [mindex]);
+
+    if (string [mindex])
+        return FALSE;
+
+    lower [mindex] = '\0';
+    nmoves = generate_move_list (moves, &frame->pos);
+
+    for (mindex = 0; mindex < nmoves; ++mindex)
+        if (!strcmp (move_string (moves + mindex, legal), lower)) {
+            *move = moves [mindex];
+            return TRUE;
+        }
+
+    return FALSE;
+}
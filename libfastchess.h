@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////////
+//                          **** FAST-CHESS ****                          //
+//                     Trivial Chess Playing Program                      //
+//                    Copyright (c) 2020 David Bryant                     //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// libfastchess.h
+
+// The interface for embedding the engine in other programs (libfastchess),
+// which needs nothing from fast-chess.h. Each engine instance has its own
+// position, thread count and transposition table, and any number of them
+// can be used at once from different threads. The calls on one instance
+// must not overlap, except that fastchess_stop() can be called from another
+// thread at any time while the instance exists (typically while
+// fastchess_search() is running, but also just before it starts). Moves are
+// passed and returned as strings in long algebraic notation, the same as
+// UCI (e.g., "e2e4", "e1g1" for castling, "e7e8q" for promotion).
+
+#ifndef LIBFASTCHESS_H
+#define LIBFASTCHESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FASTCHESS_MAX_MOVES     120     // room for the legal moves of any position
+#define FASTCHESS_MAX_PV        32      // longest principal variation returned
+#define FASTCHESS_MAX_FEN       100     // room for any position in Forsyth-Edwards Notation
+
+/* results of fastchess_status() */
+
+#define FASTCHESS_PLAYING       0
+#define FASTCHESS_CHECKMATE     1
+#define FASTCHESS_STALEMATE     2
+#define FASTCHESS_DRAW          3       // by insufficient material, 50 moves or repetition
+
+typedef struct fastchess FASTCHESS;
+
+// Limits for fastchess_search(); the search deepens one ply at a time until
+// any limit that's not 0 is reached (or fastchess_stop() is called), and if
+// none are given it searches to depth 6.
+
+typedef struct {
+    int depth;                          // plies
+    int move_time;                      // milliseconds to spend on this move
+    int clock_time, clock_increment;    // milliseconds left on our clock, and added per move
+    int moves_to_go;                    // moves until the next time control (0 = unknown)
+    long long max_nodes;                // stop after about this many nodes
+} FASTCHESS_LIMITS;
+
+typedef struct {
+    char bestmove [6];                  // "" if there are no legal moves
+    int score;                          // centipawns, from the side to move (0 if mate is set)
+    int mate;                           // moves to mate (negative if getting mated), or 0
+    int depth;                          // deepest iteration completed
+    long long nodes, millisecs;         // nodes searched and time taken
+    char pv [FASTCHESS_MAX_PV * 6];     // principal variation (moves separated by spaces)
+} FASTCHESS_RESULT;
+
+FASTCHESS *fastchess_create (int threads, int hash_megabytes);
+void fastchess_destroy (FASTCHESS *engine);
+int fastchess_set_position (FASTCHESS *engine, const char *fen, const char *moves);
+char *fastchess_get_position (FASTCHESS *engine, char *fen);
+int fastchess_legal_moves (FASTCHESS *engine, char moves [] [6]);
+int fastchess_make_move (FASTCHESS *engine, const char *move);
+int fastchess_status (FASTCHESS *engine);
+int fastchess_search (FASTCHESS *engine, const FASTCHESS_LIMITS *limits, FASTCHESS_RESULT *result);
+void fastchess_stop (FASTCHESS *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
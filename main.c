@@ -26,9 +26,10 @@
 // your king in the center of the board.
 
 // Another thing I wanted was for the program to not play the same game every
-// time, so it randomly scrambles the moves before evaluating them (which
-// results in different outcomes). This also makes it more interesting when
-// it plays itself (which is a feature I've used extensively in development).
+// time, so it randomly breaks ties between moves that are ordered the same
+// before evaluating them (which results in different outcomes). This also
+// makes it more interesting when it plays itself (which is a feature I've
+// used extensively in development).
 
 // To its credit it does handle all legal chess, including castling and its
 // rules, en passant capture, and detecting draws based on the 50-move and
@@ -45,6 +46,28 @@
 int _kbhit (void), getch (void);
 #endif
 
+// the results of the games played (by the computer against itself, usually)
+
+typedef struct {
+    int games, whitewins, blackwins, draws, whitedraws, blackdraws, maxmoves, minmoves;
+    long totalmoves;
+} GAME_STATS;
+
+// the settings of each engine ("player") in a match (see run_match())
+
+typedef struct {
+    int level, flags, move_time, clock_time, clock_increment;
+    long long max_nodes;
+} PLAYER;
+
+static void record_game (GAME_STATS *stats, POSITION *pos);
+static int parse_player (PLAYER *player, char *spec);
+static void run_match (PLAYER players [2], int games, double *sprt, unsigned int seed, int max_threads, int hash_megabytes);
+static double sprt_llr (int results [3], double *sprt);
+static void print_game_stats (GAME_STATS *stats, long long play_time);
+#ifdef SEARCH_STATS
+static void print_search_counts (FILE *out, SEARCH_COUNTS *counts);
+#endif
 static void print_frame (FILE *out, FRAME *frame);
 static void print_square (FILE *out, FRAME *frame, int rank, int file);
 static void print_square_name (FILE *out, int index);
@@ -53,6 +76,10 @@ static void print_game (FILE *out, MOVE *gameplay, int nmoves);
 static int input_square_name (char **in);
 static int input_move (char *in, MOVE *move);
 static int input_game (FILE *in, MOVE **gameplay, int *gameplay_moves);
+static void run_perft (FRAME *frame, int depth, int bulk);
+static void run_uci (int max_threads, int hash_megabytes, int flags, char *command);
+static void run_batch (FILE *in, int max_threads, int flags, int depth, SEARCH_LIMITS *limits, int json);
+static int run_bench (int depth, int max_threads, int hash_megabytes, int flags);
 
 static const char *sign_on = "\n"
 " FAST-CHESS  Trivial Chess Playing Program  Version 0.2\n"
@@ -64,34 +91,78 @@ static char *help = "\n\
   -H:     display this help message\n\
   -R:     randomize for different games\n\
   -Tn:    maximum thread count, 0 or 1 for single-threaded\n\
+  -L:     lazy SMP (threads share only the hash table) instead of splitting\n\
+  -Mn:    hash table size in megabytes (default = 64, 0 = no hash table)\n\
   -Gn:    specify number of games to play (otherwise stops on keypress)\n\
   -Wn:    computer plays white at level n (1 to about 6; higher is slower)\n\
-  -Bn:    computer plays black at level n (1 to about 6; higher is slower)\n\n\
+  -Bn:    computer plays black at level n (1 to about 6; higher is slower)\n\
+  -Sn:    search each computer move for n seconds (fractions allowed)\n\
+  -Kn:    search each computer move for about n thousand nodes\n\
+  -Cn+i:  play on a clock of n seconds per side plus i seconds per move\n\
+          (with -S, -K or -C the levels are just maximum search depths)\n\
+  -Xn:    no selective search (add 1 = null move, 2 = reductions, 4 = futility\n\
+          to just disable those; default is all of them)\n\
+  -Pn:    run perft (move generator test) to depth n and exit\n\
+  -N:     no bulk counting at last perft ply (execute every leaf move)\n\
+  -U:     speak UCI (for GUIs and tournament managers) instead of playing\n\
+  -Af:    analyze every position in EPD or FEN file f (one per line, or\n\
+          \"-\" for stdin) using all threads and exit, writing CSV lines\n\
+          (index,fen,bestmove,score,nodes,depth) as each search finishes\n\
+  -J:     write JSON lines instead of CSV for -A\n\
+  -Dn:    search depth for -A (default = 6, or unlimited with -S or -K)\n\
+  -Yn:    benchmark: search 40 built-in positions to depth n (default = 7)\n\
+          on one thread (the total nodes are a signature of the search) and\n\
+          then on all threads (to show the speedup, and check that they don't\n\
+          search many more nodes than one thread), and exit\n\
+  -I:     show search statistics (nodes, nodes/sec, branching factor,\n\
+          cutoffs, etc.) for each computer move (builds with -DSEARCH_STATS)\n\
+  -Vn:    play a match of n games between engines A and B (with alternating\n\
+          colors) on all threads, one game per thread, and exit\n\
+  -Eas:   settings s for engine A in a match, and -Ebs for engine B; these\n\
+          are like the options above, separated by commas (e.g., L5,F21,S0.1\n\
+          is level 5, eval flags 21, 0.1 second per move); L, F, S, K, C and\n\
+          X are allowed, and the defaults come from -S, -K, -C and -X (and\n\
+          level 4, or no depth limit with -S, -K or -C)\n\
+  -Zl,u:  stop the match once a sequential probability ratio test decides\n\
+          that A is either l or u Elo stronger than B (5% error rates)\n\n\
  Commands:\n\
   H <cr>:        display this help message\n\
   W n <cr>:      computer plays white at level n\n\
   B n <cr>:      computer plays black at level n\n\
   E n <cr>:      evaluate legal moves at level n (default=1)\n\
   T n <cr>:      take back n moves (default=1)\n\
+  P n <cr>:      run perft to depth n with move breakdown (default=1)\n\
   W <cr>:        returns white play to user\n\
   B <cr>:        returns black play to user\n\
   S <file><cr>:  save game to specified file\n\
   L <file><cr>:  load game from specified file\n\
   R <cr>:        resign game and start new game\n\
-  Q <cr>:        resign game and quit\n\n";
+  Q <cr>:        resign game and quit\n\
+  uci <cr>:      switch to UCI protocol (same as -U)\n\n";
 
 int main (argc, argv) int argc; char **argv;
 {
-    int nmoves, mindex, maxmoves = 0, minmoves = 1000, asked4help = FALSE, quit = FALSE, resign = FALSE, max_threads;
-    int games_to_play = 0, games = 0, whitewins = 0, blackwins = 0, draws = 0, whitedraws = 0, blackdraws = 0;
-    int default_flags = EVAL_POSITION | EVAL_SCALE | EVAL_PRUNE | EVAL_DECAY | EVAL_SCRAMBLE;
-    int white_level = 0, black_level = 0, level;
-    time_t start_time, stop_time;
+    int nmoves, mindex, asked4help = FALSE, quit = FALSE, resign = FALSE, max_threads, games_to_play = 0;
+    int default_flags = EVAL_POSITION | EVAL_SCALE | EVAL_PRUNE | EVAL_DECAY | EVAL_SCRAMBLE |
+        EVAL_NULL_MOVE | EVAL_REDUCE | EVAL_FUTILITY;
+    int white_level = 0, black_level = 0, level, perft_depth = 0, perft_bulk = TRUE, hash_megabytes = 64, uci = FALSE;
+    int batch_depth = 0, batch_json = FALSE, match_games = 0, bench_depth = 0;
+    char *player_specs [2] = { NULL, NULL };
+    double sprt [2], *sprt_p = NULL;
+    unsigned int match_seed = 0;
+    int move_time = 0, clock_time = 0, clock_increment = 0, white_clock, black_clock;
+    long long max_nodes = 0, turn_start, start_time;
+    SEARCH_LIMITS limits;
     MOVE moves [MAX_MOVES + 10];
-    char *init_filename = NULL;
-    long totalmoves = 0;
+    char *init_filename = NULL, *batch_filename = NULL;
+    GAME_STATS stats = { 0, 0, 0, 0, 0, 0, 0, 1000, 0 };
+    uint64_t history [MAX_HISTORY];
     FRAME frame;
     FILE *file;
+#ifdef SEARCH_STATS
+    SEARCH_COUNTS counts;
+    int verbose = FALSE;
+#endif
 
 #ifdef _WIN32
     SYSTEM_INFO sysinfo;
@@ -125,12 +196,112 @@ int main (argc, argv) int argc; char **argv;
                 case 'R': case 'r':
                     init_random (time (NULL));
                     srand (time (NULL));
+                    match_seed = time (NULL);
                     break;
 
                 case 'T': case 't':
                     max_threads = atoi (++*argv);
                     break;
 
+                case 'L': case 'l':
+                    default_flags |= EVAL_LAZY_SMP;
+                    break;
+
+                case 'M': case 'm':
+                    hash_megabytes = atoi (++*argv);
+                    break;
+
+                case 'P': case 'p':
+                    perft_depth = atoi (++*argv);
+                    break;
+
+                case 'N': case 'n':
+                    perft_bulk = FALSE;
+                    break;
+
+                case 'U': case 'u':
+                    uci = TRUE;
+                    break;
+
+                case 'A': case 'a':
+                    batch_filename = ++*argv;
+                    break;
+
+                case 'D': case 'd':
+                    batch_depth = atoi (++*argv);
+                    break;
+
+                case 'J': case 'j':
+                    batch_json = TRUE;
+                    break;
+
+                case 'Y': case 'y':
+                    bench_depth = atoi (++*argv);
+
+                    if (bench_depth < 1)
+                        bench_depth = 7;
+
+                    break;
+
+                case 'I': case 'i':
+#ifdef SEARCH_STATS
+                    verbose = TRUE;
+#else
+                    fprintf (stderr, "search statistics need a build with -DSEARCH_STATS\n");
+#endif
+                    break;
+
+                case 'V': case 'v':
+                    match_games = atoi (++*argv);
+                    break;
+
+                case 'E': case 'e':
+                    if (tolower (*++*argv) != 'a' && tolower (**argv) != 'b') {
+                        fprintf (stderr, "need engine a or b: %s\n%s", *argv - 2, help);
+                        exit (1);
+                    }
+
+                    player_specs [tolower (**argv) - 'a'] = *argv + 1;
+                    break;
+
+                case 'Z': case 'z':
+                    if (sscanf (++*argv, "%lf,%lf", sprt, sprt + 1) != 2 || sprt [0] >= sprt [1]) {
+                        fprintf (stderr, "need lower and upper Elo: %s\n%s", *argv - 2, help);
+                        exit (1);
+                    }
+
+                    sprt_p = sprt;
+                    break;
+
+                case 'X': case 'x': {
+                    int disable = atoi (++*argv);
+
+                    if (!disable) disable = 7;
+                    if (disable & 1) default_flags &= ~EVAL_NULL_MOVE;
+                    if (disable & 2) default_flags &= ~EVAL_REDUCE;
+                    if (disable & 4) default_flags &= ~EVAL_FUTILITY;
+                    break;
+                }
+
+                case 'S': case 's':
+                    move_time = (int) (strtod (++*argv, NULL) * 1000.0);
+                    break;
+
+                case 'K': case 'k':
+                    max_nodes = strtoll (++*argv, NULL, 10) * 1000;
+                    break;
+
+                case 'C': case 'c': {
+                    char *cptr;
+
+                    clock_time = (int) (strtod (++*argv, &cptr) * 1000.0);
+
+                    if (*cptr == '+')
+                        clock_increment = (int) (strtod (cptr + 1, NULL) * 1000.0);
+
+                    break;
+                }
+
                 default:
                     fprintf (stderr, "illegal option: %s\n%s", --*argv, help);
                     exit (1);
@@ -143,18 +314,76 @@ int main (argc, argv) int argc; char **argv;
             init_filename = *argv;
     }
 
-    printf ("%s", sign_on);
+    if (!uci && !batch_filename && !match_games && !bench_depth)
+        printf ("%s", sign_on);
 
     if (asked4help)
         printf ("%s", help);
 
-    time (&start_time);
+    if (!init_hash_table (hash_megabytes)) {
+        fprintf (stderr, "can't allocate %d megabyte hash table!\n", hash_megabytes);
+        exit (1);
+    }
+
+    max_threads = init_thread_pool (max_threads);
+
+    if (uci) {
+        run_uci (max_threads, hash_megabytes, default_flags, NULL);
+        exit (0);
+    }
+
+    if (bench_depth) {
+        exit (run_bench (bench_depth, max_threads, hash_megabytes, default_flags) ? 0 : 1);
+    }
+
+    if (batch_filename) {
+        FILE *in = strcmp (batch_filename, "-") ? fopen (batch_filename, "rt") : stdin;
+
+        if (!in) {
+            fprintf (stderr, "can't open file %s\n", batch_filename);
+            exit (1);
+        }
+
+        memset (&limits, 0, sizeof (limits));
+        limits.move_time = move_time;
+        limits.max_nodes = max_nodes;
+
+        if (!batch_depth && !move_time && !max_nodes)
+            batch_depth = 6;
+
+        run_batch (in, max_threads, default_flags, batch_depth, &limits, batch_json);
+        exit (0);
+    }
+
+    if (match_games) {
+        PLAYER players [2];
+        int pindex;
+
+        for (pindex = 0; pindex < 2; ++pindex) {
+            players [pindex].level = (move_time || max_nodes || clock_time) ? 0 : 4;
+            players [pindex].flags = default_flags;
+            players [pindex].move_time = move_time;
+            players [pindex].max_nodes = max_nodes;
+            players [pindex].clock_time = clock_time;
+            players [pindex].clock_increment = clock_increment;
+
+            if (player_specs [pindex] && !parse_player (players + pindex, player_specs [pindex])) {
+                fprintf (stderr, "invalid settings for engine %c: %s\n", 'A' + pindex, player_specs [pindex]);
+                exit (1);
+            }
+        }
+
+        run_match (players, match_games, sprt_p, match_seed, max_threads, hash_megabytes);
+        exit (0);
+    }
+
+    start_time = current_millisecs ();
 
     while (!quit && (!white_level || !black_level || !_kbhit())) {
         int gameplay_moves = 0;
         MOVE *gameplay = NULL;
 
-        init_frame (&frame);
+        init_frame (&frame, history);
 
         if (init_filename) {
             FILE *file = fopen (init_filename, "rt");
@@ -164,7 +393,7 @@ int main (argc, argv) int argc; char **argv;
                     for (mindex = 0; mindex < gameplay_moves; ++mindex)
                         execute_move (&frame, gameplay + mindex);
 
-                if (frame.move_number == 1 && !frame.move_color)
+                if (frame.pos.move_number == 1 && !frame.pos.move_color)
                     fprintf (stderr, "\ninvalid game file %s\n\007", init_filename);
 
                 fclose (file);
@@ -175,10 +404,19 @@ int main (argc, argv) int argc; char **argv;
             init_filename = NULL;
         }
 
-        while (!frame.drawn_game) {
+        if (perft_depth) {
+            frame.max_threads = max_threads;
+            run_perft (&frame, perft_depth, perft_bulk);
+            exit (0);
+        }
+
+        white_clock = black_clock = clock_time;
+        turn_start = current_millisecs ();
+
+        while (!frame.pos.drawn_game) {
             MOVE bestmove;
 
-            level = (frame.move_color) ? black_level : white_level;
+            level = (frame.pos.move_color) ? black_level : white_level;
             bestmove.from = 0;
 
             if (level > 0) {
@@ -186,9 +424,34 @@ int main (argc, argv) int argc; char **argv;
                 frame.flags = default_flags;
                 frame.max_threads = max_threads;
                 frame.bestmove_p = &bestmove;
+
+                if (move_time || max_nodes || clock_time) {
+                    memset (&limits, 0, sizeof (limits));
+                    limits.move_time = move_time;
+                    limits.max_nodes = max_nodes;
+
+                    if (clock_time) {
+                        limits.clock_time = frame.pos.move_color ? black_clock : white_clock;
+                        limits.clock_increment = clock_increment;
+
+                        if (limits.clock_time < 1)
+                            limits.clock_time = 1;
+                    }
+
+                    frame.limits_p = &limits;
+                }
+
+#ifdef SEARCH_STATS
+                if (verbose)
+                    frame.counts_p = &counts;
+#endif
                 eval_position (&frame);
+                frame.limits_p = NULL;
+#ifdef SEARCH_STATS
+                frame.counts_p = NULL;
+#endif
             }
-            else if ((nmoves = generate_move_list (moves, &frame)) != 0) {
+            else if ((nmoves = generate_move_list (moves, &frame.pos)) != 0) {
                 if (nmoves > MAX_MOVES) {
                     print_frame (stdout, &frame);
                     fprintf (stderr, "%d legal moves!\n", nmoves);
@@ -210,6 +473,11 @@ int main (argc, argv) int argc; char **argv;
                     *cptr = '\0';
                     cptr = command;
 
+                    if (!strcmp (command, "uci")) {
+                        run_uci (max_threads, hash_megabytes, default_flags, command);
+                        exit (0);
+                    }
+
                     if (input_move (cptr, &bestmove)) {
 
                         for (mindex = 0; mindex < nmoves; ++mindex)
@@ -228,7 +496,7 @@ int main (argc, argv) int argc; char **argv;
                         }
                     }
                     else {
-                        int eval_level, take_back = 0;;
+                        int eval_level, perft_level, take_back = 0;;
 
                         while (*++cptr && *cptr == ' ');
 
@@ -269,7 +537,7 @@ int main (argc, argv) int argc; char **argv;
                                     take_back = gameplay_moves;
 
                                 if (take_back) {
-                                    init_frame (&frame);
+                                    init_frame (&frame, history);
                                     gameplay_moves -= take_back;
 
                                     for (mindex = 0; mindex < gameplay_moves; ++mindex)
@@ -313,6 +581,14 @@ int main (argc, argv) int argc; char **argv;
 
                                 break;
 
+                            case 'P': case 'p':
+                                perft_level = atoi (cptr);
+                                if (perft_level < 1) perft_level = 1;
+
+                                frame.max_threads = max_threads;
+                                run_perft (&frame, perft_level, perft_bulk);
+                                break;
+
                             case 'S': case 's':
                                 if (!*cptr) {
                                     fprintf (stderr, "\nneed filename\n\007");
@@ -345,7 +621,7 @@ int main (argc, argv) int argc; char **argv;
                                 }
 
                                 fclose (file);
-                                init_frame (&frame);
+                                init_frame (&frame, history);
 
                                 for (mindex = 0; mindex < gameplay_moves; ++mindex)
                                     execute_move (&frame, gameplay + mindex);
@@ -369,20 +645,44 @@ int main (argc, argv) int argc; char **argv;
                 else
                     bestmove = moves [rand () % nmoves];
             }
-            else if (!frame.in_check)
-                frame.drawn_game = STALEMATE;
+            else if (!frame.pos.in_check)
+                frame.pos.drawn_game = STALEMATE;
 
             if (bestmove.from) {
-                if (frame.move_color) {
+                long long now = current_millisecs ();
+
+                if (frame.pos.move_color)
+                    black_clock += clock_increment - (int) (now - turn_start);
+                else
+                    white_clock += clock_increment - (int) (now - turn_start);
+
+                turn_start = now;
+
+                if (frame.pos.move_color) {
                     print_move (stdout, &bestmove);
                     putchar ('\n');
                 }
                 else {
-                    printf ("%3d: ", frame.move_number);
+                    printf ("%3d: ", frame.pos.move_number);
                     print_move (stdout, &bestmove);
                     fflush (stdout);
                 }
 
+#ifdef SEARCH_STATS
+                // the statistics go under the move, and then black's move
+                // (if any) is lined up under white's
+
+                if (verbose && level > 0) {
+                    if (!frame.pos.move_color)
+                        putchar ('\n');
+
+                    print_search_counts (stdout, &counts);
+
+                    if (!frame.pos.move_color)
+                        printf ("%13s", "");
+                }
+#endif
+
                 execute_move (&frame, &bestmove);
                 gameplay = realloc (gameplay, (gameplay_moves + 1) * sizeof (MOVE));
                 gameplay [gameplay_moves++] = bestmove;
@@ -394,44 +694,356 @@ int main (argc, argv) int argc; char **argv;
         free (gameplay);
         gameplay = NULL;
 
-        if (frame.move_number > 1 || frame.move_color) {
-            if (frame.drawn_game) {
-                draws++;
+        if (frame.pos.move_number > 1 || frame.pos.move_color) {
+            record_game (&stats, &frame.pos);
+            print_frame (stdout, &frame);
+            printf ("-------------------------------------");
+            printf ("-------------------------------------\n");
 
-                if (frame.white_material > frame.black_material)
-                    ++whitedraws;
-                else if (frame.black_material > frame.white_material)
-                    ++blackdraws;
-            }
-            else
-                frame.move_color ? ++whitewins : ++blackwins;
+            if (games_to_play && games_to_play == stats.games)
+                break;
+        }
+    }
+
+    if (_kbhit ())
+        getch ();
 
-            totalmoves += (2 * frame.move_number) - (frame.move_color ? 1 : 2);
+    if (!stats.games)
+        exit (0);
 
-            if (frame.move_number < minmoves)
-                minmoves = frame.move_number;
+    print_game_stats (&stats, current_millisecs () - start_time);
+    return 0;
+}
 
-            if (frame.move_number > maxmoves)
-                maxmoves = frame.move_number;
+// Match mode (-V) plays games between two engines, "A" and "B", which are
+// really the same engine with the settings of each "player" (-Ea and -Eb).
+// As many games are played at once as there are threads, each one searched
+// by just its own thread, so there's no splitting overhead and all the cores
+// are busy all the time. Each pair of games starts with the same few random
+// moves, once with A playing white and once with B playing white. With -Z,
+// the match ends early once a sequential probability ratio test (SPRT) can
+// decide between A being "elo0" or "elo1" stronger than B; this uses the
+// usual normal approximation of the log-likelihood ratio of the results so
+// far, with both error rates at 5%. The games still going when the match
+// is decided are abandoned. Each player of each game has its own hash table
+// (of the size given with -M), so that the two engines never see each
+// other's entries (which can come from different evaluations) and games
+// being played at the same time don't age each other's entries.
+
+#define OPENING_PLIES   4       // random moves at the start of each pair of games
+#define SPRT_ALPHA      0.05
+#define SPRT_BETA       0.05
+
+typedef struct {
+    PLAYER *players;
+    GAME_STATS stats;
+    int games_to_play, games_started, results [3], stop;   // results: A wins, draws, B wins
+    int hash_megabytes;                                     // for each player's table
+    double *sprt, llr;
+    unsigned int seed;
+    pthread_mutex_t mutex;
+} MATCH;
+
+// Settings are like the command-line options (without the dashes), each
+// overriding the corresponding default, and separated by commas.
+
+static int parse_player (PLAYER *player, char *spec)
+{
+    char *cptr = spec;
 
-            print_frame (stdout, &frame);
-            printf ("-------------------------------------");
-            printf ("-------------------------------------\n");
+    while (*cptr) {
+        int option = toupper (*cptr++);
 
-            ++games;
+        switch (option) {
+            case 'L':
+                player->level = (int) strtol (cptr, &cptr, 10);
+                break;
 
-            if (games_to_play && games_to_play == games)
+            case 'F':
+                player->flags = (int) strtol (cptr, &cptr, 0);
                 break;
+
+            case 'S':
+                player->move_time = (int) (strtod (cptr, &cptr) * 1000.0);
+                break;
+
+            case 'K':
+                player->max_nodes = strtoll (cptr, &cptr, 10) * 1000;
+                break;
+
+            case 'C':
+                player->clock_time = (int) (strtod (cptr, &cptr) * 1000.0);
+
+                if (*cptr == '+')
+                    player->clock_increment = (int) (strtod (cptr + 1, &cptr) * 1000.0);
+
+                break;
+
+            case 'X': {
+                int disable = (int) strtol (cptr, &cptr, 10);
+
+                if (!disable) disable = 7;
+                if (disable & 1) player->flags &= ~EVAL_NULL_MOVE;
+                if (disable & 2) player->flags &= ~EVAL_REDUCE;
+                if (disable & 4) player->flags &= ~EVAL_FUTILITY;
+                break;
+            }
+
+            default:
+                return FALSE;
         }
+
+        if (*cptr == ',')
+            cptr++;
+        else if (*cptr)
+            return FALSE;
     }
 
-    time (&stop_time);
+    return player->level >= 0 && player->level < MAX_DEPTH &&
+        (player->level || player->move_time || player->max_nodes || player->clock_time);
+}
 
-    if (_kbhit ())
-        getch ();
+// Play the specified game of the match to the end (returning TRUE) or until
+// the match is stopped (returning FALSE), leaving the final position in the
+// frame. The searches use the move tables of the specified thread, and the
+// hash tables given for the players.
 
-    if (!games)
-        exit (0);
+static int play_match_game (MATCH *match, int game, int thread_index, FRAME *frame, uint64_t history [],
+    HASH_TABLE *tables [2])
+{
+    unsigned int seed = match->seed + (game >> 1) * 2654435761U;
+    int a_white = !(game & 1), clocks [2], ply;
+    MOVE moves [MAX_MOVES + 10];
+    SEARCH_LIMITS limits;
+
+    init_frame (frame, history);
+
+    for (ply = 0; ply < OPENING_PLIES; ++ply) {
+        int nmoves = generate_move_list (moves, &frame->pos);
+
+        seed = seed * 1103515245 + 12345;
+        execute_move (frame, moves + (seed >> 16) % nmoves);
+    }
+
+    clocks [0] = match->players [0].clock_time;
+    clocks [1] = match->players [1].clock_time;
+
+    while (!frame->pos.drawn_game) {
+        int pindex = (frame->pos.move_color ? 1 : 0) ^ (a_white ? 0 : 1);
+        PLAYER *player = match->players + pindex;
+        long long turn_start = current_millisecs ();
+        MOVE bestmove;
+
+        frame->depth = player->level;
+        frame->flags = player->flags;
+        frame->max_threads = 1;
+        frame->thread_index = thread_index;
+        frame->hash_p = tables [pindex];
+        frame->bestmove_p = &bestmove;
+        frame->limits_p = NULL;
+        bestmove.from = 0;
+
+        if (player->move_time || player->max_nodes || player->clock_time) {
+            memset (&limits, 0, sizeof (limits));
+            limits.move_time = player->move_time;
+            limits.max_nodes = player->max_nodes;
+
+            if (player->clock_time) {
+                limits.clock_time = clocks [pindex] > 1 ? clocks [pindex] : 1;
+                limits.clock_increment = player->clock_increment;
+            }
+
+            frame->limits_p = &limits;
+        }
+
+        eval_position (frame);
+        frame->limits_p = NULL;
+        frame->hash_p = NULL;
+        clocks [pindex] += player->clock_increment - (int) (current_millisecs () - turn_start);
+
+        if (__atomic_load_n (&match->stop, __ATOMIC_RELAXED))
+            return FALSE;
+
+        if (!bestmove.from && generate_move_list (moves, &frame->pos))
+            bestmove = moves [0];
+
+        if (!bestmove.from) {
+            if (!frame->pos.in_check)
+                frame->pos.drawn_game = STALEMATE;
+
+            break;
+        }
+
+        execute_move (frame, &bestmove);
+    }
+
+    return TRUE;
+}
+
+// Each thread plays games until there are no more (or the match is stopped),
+// adding the results (and printing a line for each game) under the mutex.
+
+static void match_job (void *context, int thread_index)
+{
+    MATCH *match = (MATCH *) context;
+    uint64_t history [MAX_HISTORY];
+    FRAME frame;
+
+    while (1) {
+        int game, a_white, a_lost, result, finished;
+        HASH_TABLE *tables [2];
+
+        pthread_mutex_lock (&match->mutex);
+
+        if (match->stop || match->games_started == match->games_to_play) {
+            pthread_mutex_unlock (&match->mutex);
+            break;
+        }
+
+        game = match->games_started++;
+        pthread_mutex_unlock (&match->mutex);
+
+        tables [0] = new_hash_table (match->hash_megabytes);
+        tables [1] = new_hash_table (match->hash_megabytes);
+
+        if (!tables [0] || !tables [1]) {
+            fprintf (stderr, "can't allocate %d megabyte hash tables for game %d!\n", match->hash_megabytes, game + 1);
+            __atomic_store_n (&match->stop, TRUE, __ATOMIC_RELAXED);
+            finished = FALSE;
+        }
+        else
+            finished = play_match_game (match, game, thread_index, &frame, history, tables);
+
+        free_hash_table (tables [0]);
+        free_hash_table (tables [1]);
+
+        if (!finished)
+            break;
+
+        a_white = !(game & 1);
+        a_lost = frame.pos.move_color ? !a_white : a_white;     // if it's not drawn, the side to move lost
+        result = frame.pos.drawn_game ? 1 : a_lost ? 2 : 0;
+
+        pthread_mutex_lock (&match->mutex);
+        record_game (&match->stats, &frame.pos);
+        match->results [result]++;
+        printf ("game %d (A %s): %s in %d moves, A +%d =%d -%d", game + 1, a_white ? "white" : "black",
+            result == 1 ? "draw" : result ? "B won" : "A won", frame.pos.move_number,
+            match->results [0], match->results [1], match->results [2]);
+
+        if (match->sprt) {
+            printf (", LLR %.2f", match->llr = sprt_llr (match->results, match->sprt));
+
+            if (match->llr >= log ((1.0 - SPRT_BETA) / SPRT_ALPHA) || match->llr <= log (SPRT_BETA / (1.0 - SPRT_ALPHA)))
+                __atomic_store_n (&match->stop, TRUE, __ATOMIC_RELAXED);
+        }
+
+        printf ("\n");
+        fflush (stdout);
+        pthread_mutex_unlock (&match->mutex);
+    }
+}
+
+// The expected score of a player that's "elo" stronger than its opponent,
+// and the log-likelihood ratio of the results (A's wins, draws and losses)
+// for A being sprt [1] stronger than B vs. being sprt [0] stronger.
+
+static double elo_score (double elo)
+{
+    return 1.0 / (1.0 + pow (10.0, -elo / 400.0));
+}
+
+static double sprt_llr (int results [3], double *sprt)
+{
+    double games = results [0] + results [1] + results [2], wins, draws, score, variance;
+    double score0 = elo_score (sprt [0]), score1 = elo_score (sprt [1]);
+
+    if (!results [0] + !results [1] + !results [2] >= 2)
+        return 0.0;     // not enough different results to estimate the variance
+
+    wins = results [0] / games;
+    draws = results [1] / games;
+    score = wins + draws / 2.0;
+    variance = (wins + draws / 4.0 - score * score) / games;
+    return (score1 - score0) * (2.0 * score - score0 - score1) / (2.0 * variance);
+}
+
+static void run_match (PLAYER players [2], int games, double *sprt, unsigned int seed, int max_threads, int hash_megabytes)
+{
+    long long start_time;
+    double score;
+    MATCH match;
+
+    memset (&match, 0, sizeof (match));
+    match.players = players;
+    match.games_to_play = games;
+    match.sprt = sprt;
+    match.seed = seed;
+    match.hash_megabytes = hash_megabytes;
+    match.stats.minmoves = 1000;
+    pthread_mutex_init (&match.mutex, NULL);
+
+    start_time = current_millisecs ();
+    run_parallel (match_job, &match, max_threads);
+
+    if (!match.stats.games)
+        return;
+
+    printf ("-------------------------------------");
+    printf ("-------------------------------------\n");
+    print_game_stats (&match.stats, current_millisecs () - start_time);
+    score = (match.results [0] + match.results [1] / 2.0) / match.stats.games;
+    printf ("A won %d, B won %d, %d drawn: A scored %.1f%%", match.results [0], match.results [2],
+        match.results [1], score * 100.0);
+
+    if (score > 0.0 && score < 1.0)
+        printf (" (%+.0f Elo)\n", 400.0 * log10 (score / (1.0 - score)));
+    else
+        printf ("\n");
+
+    if (sprt) {
+        if (match.llr >= log ((1.0 - SPRT_BETA) / SPRT_ALPHA))
+            printf ("SPRT: A is %g Elo stronger than B (LLR %.2f)\n", sprt [1], match.llr);
+        else if (match.llr <= log (SPRT_BETA / (1.0 - SPRT_ALPHA)))
+            printf ("SPRT: A is only %g Elo stronger than B (LLR %.2f)\n", sprt [0], match.llr);
+        else
+            printf ("SPRT: undecided (LLR %.2f)\n", match.llr);
+    }
+
+    pthread_mutex_destroy (&match.mutex);
+}
+
+// Add the result of a finished game (with the specified final position) to
+// the statistics; if it's not drawn, the side to move lost.
+
+static void record_game (GAME_STATS *stats, POSITION *pos)
+{
+    if (pos->drawn_game) {
+        stats->draws++;
+
+        if (pos->white_material > pos->black_material)
+            ++stats->whitedraws;
+        else if (pos->black_material > pos->white_material)
+            ++stats->blackdraws;
+    }
+    else
+        pos->move_color ? ++stats->whitewins : ++stats->blackwins;
+
+    stats->totalmoves += (2 * pos->move_number) - (pos->move_color ? 1 : 2);
+
+    if (pos->move_number < stats->minmoves)
+        stats->minmoves = pos->move_number;
+
+    if (pos->move_number > stats->maxmoves)
+        stats->maxmoves = pos->move_number;
+
+    ++stats->games;
+}
+
+static void print_game_stats (GAME_STATS *stats, long long play_time)
+{
+    int games = stats->games, whitewins = stats->whitewins, blackwins = stats->blackwins;
+    int draws = stats->draws, whitedraws = stats->whitedraws, blackdraws = stats->blackdraws;
 
     if (games == 1) {
         if (whitewins || blackwins)
@@ -455,19 +1067,59 @@ int main (argc, argv) int argc; char **argv;
     else
         printf ("%d games total, white won %d and black won %d\n", games, whitewins, blackwins);
 
-    printf ("%ld total moves made\n", totalmoves);
-    printf ("%u max moves per game\n", maxmoves);
-    printf ("%u min moves per game\n", minmoves);
-    printf ("play time: %ld seconds\n", stop_time - start_time);
+    printf ("%ld total moves made\n", stats->totalmoves);
+    printf ("%u max moves per game\n", stats->maxmoves);
+    printf ("%u min moves per game\n", stats->minmoves);
+    printf ("play time: %.3f seconds\n", play_time / 1000.0);
+}
 
-    return 0;
+#ifdef SEARCH_STATS
+
+// Display the statistics of a search (see SEARCH_COUNTS), including the
+// nodes per second and the effective branching factor (the number of nodes
+// that would give the same total if every node had that many children).
+
+static void print_search_counts (FILE *out, SEARCH_COUNTS *counts)
+{
+    long long nodes = counts->interior_nodes + counts->quiesce_nodes, cutoffs = 0;
+    int cindex;
+
+    for (cindex = 0; cindex < MAX_CUTOFF_INDEX; ++cindex)
+        cutoffs += counts->cutoffs [cindex];
+
+    fprintf (out, "     %lld nodes (%.1f%% quiescence) in %.3f seconds, %.0f nodes/sec",
+        nodes, nodes ? counts->quiesce_nodes * 100.0 / nodes : 0.0, counts->usecs / 1000000.0,
+        counts->usecs ? nodes * 1000000.0 / counts->usecs : 0.0);
+
+    if (counts->depth > 0 && nodes)
+        fprintf (out, ", depth %d, ebf %.2f", counts->depth, pow ((double) nodes, 1.0 / counts->depth));
+
+    fprintf (out, "\n     %lld evals, %lld move lists, %lld null move cutoffs, %lld cutoffs",
+        counts->evaluations, counts->move_lists, counts->null_cutoffs, cutoffs);
+
+    if (cutoffs) {
+        fprintf (out, " by move (%%):");
+
+        for (cindex = 0; cindex < MAX_CUTOFF_INDEX; ++cindex)
+            fprintf (out, " %.1f%s", counts->cutoffs [cindex] * 100.0 / cutoffs,
+                cindex == MAX_CUTOFF_INDEX - 1 ? "+" : "");
+    }
+
+    if (counts->threads > 1)
+        fprintf (out, "\n     %d threads, %lld splits, %lld helps, %.1f%% idle", counts->threads,
+            counts->splits, counts->helps, counts->usecs ?
+            counts->idle_usecs * 100.0 / counts->usecs / counts->threads : 0.0);
+
+    fprintf (out, "\n");
 }
 
+#endif
+
 static void print_frame (FILE *out, FRAME *frame)
 {
-    int rank, file, nmoves = generate_move_list (NULL, frame);
+    int rank, file, nmoves = generate_move_list (NULL, &frame->pos);
 
-    if (frame->move_color) {
+    if (frame->pos.move_color) {
         fprintf (out, "\n\n    h  g  f  e   d  c  b  a\n\n");
 
         for (rank = 1; rank <= BOARD_SIDE; ++rank) {
@@ -481,7 +1133,7 @@ static void print_frame (FILE *out, FRAME *frame)
         }
 
         fprintf (out, "\n    h  g  f  e   d  c  b  a\n\n%d: black ",
-            frame->move_number);
+            frame->pos.move_number);
     }
     else {
         fprintf (out, "\n    a  b  c  d   e  f  g  h\n\n");
@@ -497,10 +1149,10 @@ static void print_frame (FILE *out, FRAME *frame)
         }
 
         fprintf (out, "\n    a  b  c  d   e  f  g  h\n\n%d: white ",
-            frame->move_number);
+            frame->pos.move_number);
     }
 
-    if (frame->in_check) {
+    if (frame->pos.in_check) {
         if (nmoves)
             fprintf (out, "is in check with %d move%s", nmoves, nmoves > 1 ? "s" : "");
         else
@@ -513,8 +1165,8 @@ static void print_frame (FILE *out, FRAME *frame)
             fprintf (out, "is stalemated");
     }
 
-    if (nmoves && frame->drawn_game)
-        switch (frame->drawn_game) {
+    if (nmoves && frame->pos.drawn_game)
+        switch (frame->pos.drawn_game) {
 
             case NO_MATE_POWER:
                 fprintf (out, " but neither side has sufficient material\n");
@@ -532,8 +1184,8 @@ static void print_frame (FILE *out, FRAME *frame)
                 break;
         }
 
-    if (frame->white_material != frame->black_material) {
-        int white_up = frame->white_material - frame->black_material;
+    if (frame->pos.white_material != frame->pos.black_material) {
+        int white_up = frame->pos.white_material - frame->pos.black_material;
         fprintf (out, " (%s up %d point%s)\n", white_up > 0 ? "white" : "black", abs (white_up), abs (white_up) > 1 ? "s" : "");
     }
     else
@@ -546,10 +1198,10 @@ static void print_square (FILE *out, FRAME *frame, int rank, int file)
 
     fputc (' ', out);
 
-    if (SQUARE (frame, rank, file) & (PIECE | COLOR)) {
+    if (SQUARE (&frame->pos, rank, file) & (PIECE | COLOR)) {
 
-        fputc ((SQUARE (frame, rank, file) & COLOR) ? 'B' : 'W', out);
-        fputc (pnames [SQUARE (frame, rank, file) & PIECE], out);
+        fputc ((SQUARE (&frame->pos, rank, file) & COLOR) ? 'B' : 'W', out);
+        fputc (pnames [SQUARE (&frame->pos, rank, file) & PIECE], out);
     }
     else {
         fputc (((rank + file) & 1) ? '-' : '*', out);
@@ -688,6 +1340,579 @@ static int input_game (FILE *in, MOVE **gameplay, int *gameplay_moves)
     return TRUE;
 }
 
+// Run perft on the specified position and display the leaf node count for
+// each legal move, the total, and the nodes per second.
+
+static void run_perft (FRAME *frame, int depth, int bulk)
+{
+    long long counts [MAX_MOVES + 10], nodes = 0;
+    struct timeval start_time, stop_time;
+    MOVE moves [MAX_MOVES + 10];
+    int nmoves, mindex;
+    double seconds;
+
+    gettimeofday (&start_time, NULL);
+    nmoves = perft_divide (frame, depth, bulk, moves, counts);
+    gettimeofday (&stop_time, NULL);
+
+    seconds = (stop_time.tv_sec - start_time.tv_sec) +
+        (stop_time.tv_usec - start_time.tv_usec) / 1000000.0;
+
+    printf ("\n");
+
+    for (mindex = 0; mindex < nmoves; ++mindex) {
+        printf ("%3d: ", mindex + 1);
+        print_move (stdout, moves + mindex);
+        printf ("%12lld\n", counts [mindex]);
+        nodes += counts [mindex];
+    }
+
+    printf ("\nperft %d: %lld nodes in %.3f seconds", depth, nodes, seconds);
+
+    if (seconds > 0.0)
+        printf (" (%.0f nodes/sec)\n", nodes / seconds);
+    else
+        printf ("\n");
+}
+
+// UCI (Universal Chess Interface) mode, for GUIs and tournament managers.
+// The search runs on its own thread so that commands are still handled while
+// it's going (e.g., "stop" takes effect right away and "isready" is answered
+// immediately). It reports each iteration completed with an "info" line and
+// then the move with "bestmove" (but with "go infinite", not until stopped,
+// and with "go ponder", not until "ponderhit" or "stop"), and it waits for
+// those on a condition variable rather than polling. The main thread waits for any search to finish before changing anything it
+// uses (like the position, the thread count or the hash table).
+
+typedef struct {
+    FRAME frame;
+    SEARCH_LIMITS limits;
+    uint64_t history [MAX_HISTORY];
+    int max_threads, hash_megabytes, flags, infinite, ponder, stopped, searching;
+    pthread_mutex_t mutex;      // for ponder and stopped while searching
+    pthread_cond_t wake;        // signaled by "stop" and "ponderhit"
+    pthread_t thread;
+} UCI_STATE;
+
+static void uci_position (UCI_STATE *uci, char *args);
+static void uci_go (UCI_STATE *uci, char *args);
+static void uci_setoption (UCI_STATE *uci, char *args);
+static void uci_wait (UCI_STATE *uci, int stop);
+static void uci_ponderhit (UCI_STATE *uci);
+static void *uci_search (void *context);
+static void uci_report (SEARCH_LIMITS *limits, int score, MOVE pv [], int pv_length);
+static int input_uci_move (char *in, MOVE *move);
+
+static void run_uci (int max_threads, int hash_megabytes, int flags, char *command)
+{
+    UCI_STATE *uci = calloc (1, sizeof (UCI_STATE));
+    char line [8192], *cptr, *args;
+
+    uci->max_threads = uci->frame.max_threads = max_threads;
+    uci->hash_megabytes = hash_megabytes;
+    uci->flags = flags;
+    init_frame (&uci->frame, uci->history);
+    pthread_mutex_init (&uci->mutex, NULL);
+    pthread_cond_init (&uci->wake, NULL);
+    setvbuf (stdout, NULL, _IOLBF, 0);
+
+    while (command || fgets (line, sizeof (line), stdin)) {
+        if (!command)
+            command = line;
+
+        for (cptr = command + strlen (command); cptr > command && isspace (cptr [-1]); *--cptr = '\0');
+        while (isspace (*command)) command++;
+        for (args = command; *args && !isspace (*args); args++);
+        if (*args) *args++ = '\0';
+        while (isspace (*args)) args++;
+
+        if (!strcmp (command, "uci")) {
+            printf ("id name FAST-CHESS 0.2\n");
+            printf ("id author David Bryant\n");
+            printf ("option name Hash type spin default %d min 0 max 65536\n", hash_megabytes);
+            printf ("option name Threads type spin default %d min 1 max %d\n", max_threads, max_threads);
+            printf ("option name Ponder type check default false\n");
+            printf ("uciok\n");
+        }
+        else if (!strcmp (command, "isready"))
+            printf ("readyok\n");
+        else if (!strcmp (command, "ucinewgame")) {
+            uci_wait (uci, TRUE);
+
+            if (!init_hash_table (uci->hash_megabytes))
+                printf ("info string can't allocate %d megabyte hash table\n", uci->hash_megabytes);
+
+            init_frame (&uci->frame, uci->history);
+        }
+        else if (!strcmp (command, "position")) {
+            uci_wait (uci, TRUE);
+            uci_position (uci, args);
+        }
+        else if (!strcmp (command, "go")) {
+            uci_wait (uci, TRUE);
+            uci_go (uci, args);
+        }
+        else if (!strcmp (command, "stop"))
+            uci_wait (uci, TRUE);
+        else if (!strcmp (command, "ponderhit"))
+            uci_ponderhit (uci);
+        else if (!strcmp (command, "setoption")) {
+            uci_wait (uci, TRUE);
+            uci_setoption (uci, args);
+        }
+        else if (!strcmp (command, "quit"))
+            break;
+        else if (*command && strcmp (command, "debug") && strcmp (command, "register"))
+            printf ("info string unknown command %s\n", command);
+
+        command = NULL;
+    }
+
+    uci_wait (uci, TRUE);
+    pthread_cond_destroy (&uci->wake);
+    pthread_mutex_destroy (&uci->mutex);
+    free (uci);
+}
+
+// "position [startpos | fen <fen>] [moves <move> ...]", where the moves are
+// in long algebraic notation (e.g., "e2e4", "e1g1" for castling, "e7e8q")
+
+static void uci_position (UCI_STATE *uci, char *args)
+{
+    char *moves = strstr (args, "moves"), *token;
+    MOVE move, legal [MAX_MOVES + 10];
+    int nmoves, mindex;
+
+    if (moves)
+        *moves = '\0';
+
+    if (!strncmp (args, "fen", 3)) {
+        if (!init_frame_fen (&uci->frame, uci->history, args + 3))
+            printf ("info string invalid fen%s\n", args + 3);
+    }
+    else
+        init_frame (&uci->frame, uci->history);
+
+    if (!moves)
+        return;
+
+    for (token = strtok (moves + 5, " \t"); token; token = strtok (NULL, " \t")) {
+        nmoves = input_uci_move (token, &move) ? generate_move_list (legal, &uci->frame.pos) : 0;
+
+        for (mindex = 0; mindex < nmoves; ++mindex)
+            if (legal [mindex].from == move.from && legal [mindex].delta == move.delta &&
+                legal [mindex].promo == move.promo)
+                    break;
+
+        if (mindex == nmoves) {
+            printf ("info string illegal move %s\n", token);
+            break;
+        }
+
+        execute_move (&uci->frame, &move);
+    }
+}
+
+// "go" with any of "wtime", "btime", "winc", "binc", "movestogo", "movetime",
+// "nodes" and "depth" (which take values) and "infinite" and "ponder" (which
+// don't); no limits at all is also infinite. While pondering the search runs
+// with the limits given, but the move isn't sent until "ponderhit" or "stop".
+
+static void uci_go (UCI_STATE *uci, char *args)
+{
+    char *token = strtok (args, " \t"), *value;
+    int white = !uci->frame.pos.move_color;
+
+    memset (&uci->limits, 0, sizeof (uci->limits));
+    uci->limits.report = uci_report;
+    uci->infinite = uci->ponder = uci->stopped = FALSE;
+    uci->frame.depth = 0;
+
+    for (; token; token = strtok (NULL, " \t"))
+        if (!strcmp (token, "infinite"))
+            uci->infinite = TRUE;
+        else if (!strcmp (token, "ponder"))
+            uci->ponder = TRUE;
+        else if ((value = strtok (NULL, " \t")) == NULL)
+            break;
+        else if (!strcmp (token, white ? "wtime" : "btime"))
+            uci->limits.clock_time = atoi (value) > 1 ? atoi (value) : 1;
+        else if (!strcmp (token, white ? "winc" : "binc"))
+            uci->limits.clock_increment = atoi (value);
+        else if (!strcmp (token, "movestogo"))
+            uci->limits.moves_to_go = atoi (value);
+        else if (!strcmp (token, "movetime"))
+            uci->limits.move_time = atoi (value) > 1 ? atoi (value) : 1;
+        else if (!strcmp (token, "nodes"))
+            uci->limits.max_nodes = strtoll (value, NULL, 10);
+        else if (!strcmp (token, "depth"))
+            uci->frame.depth = atoi (value) > 1 ? atoi (value) : 1;
+
+    if (!uci->limits.clock_time && !uci->limits.move_time && !uci->limits.max_nodes && !uci->frame.depth)
+        uci->infinite = TRUE;
+
+    uci->frame.flags = uci->flags;
+    uci->frame.limits_p = &uci->limits;
+
+    if (pthread_create (&uci->thread, NULL, uci_search, uci)) {
+        printf ("info string can't create search thread\n");
+        uci->frame.limits_p = NULL;
+        return;
+    }
+
+    uci->searching = TRUE;
+}
+
+// "setoption name <Threads | Hash> value <n>"
+
+static void uci_setoption (UCI_STATE *uci, char *args)
+{
+    char *name = strstr (args, "name"), *value = strstr (args, "value");
+    int number;
+
+    if (!name || !value)
+        return;
+
+    for (name += 4; isspace (*name); name++);
+    number = atoi (value + 5);
+
+    if (!strncmp (name, "Threads", 7) || !strncmp (name, "threads", 7))
+        uci->frame.max_threads = number < 1 ? 1 : number > uci->max_threads ? uci->max_threads : number;
+    else if (!strncmp (name, "Hash", 4) || !strncmp (name, "hash", 4)) {
+        if (init_hash_table (number))
+            uci->hash_megabytes = number;
+        else {
+            printf ("info string can't allocate %d megabyte hash table\n", number);
+            init_hash_table (uci->hash_megabytes);
+        }
+    }
+    else if (strncmp (name, "Ponder", 6) && strncmp (name, "ponder", 6))
+        printf ("info string unknown option %s\n", name);
+}
+
+// Wait for the search (if there is one) to finish, first stopping it if
+// specified (otherwise "go infinite" would never end).
+
+static void uci_wait (UCI_STATE *uci, int stop)
+{
+    if (!uci->searching)
+        return;
+
+    if (stop) {
+        pthread_mutex_lock (&uci->mutex);
+        __atomic_store_n (&uci->limits.stop, TRUE, __ATOMIC_RELAXED);
+        uci->stopped = TRUE;
+        pthread_cond_signal (&uci->wake);
+        pthread_mutex_unlock (&uci->mutex);
+    }
+
+    pthread_join (uci->thread, NULL);
+    uci->frame.limits_p = NULL;
+    uci->searching = FALSE;
+}
+
+// "ponderhit" means the move being pondered was played, so the search goes
+// on as a normal one (and sends its move as soon as it's done).
+
+static void uci_ponderhit (UCI_STATE *uci)
+{
+    if (!uci->searching)
+        return;
+
+    pthread_mutex_lock (&uci->mutex);
+    uci->ponder = FALSE;
+    pthread_cond_signal (&uci->wake);
+    pthread_mutex_unlock (&uci->mutex);
+}
+
+static void *uci_search (void *context)
+{
+    UCI_STATE *uci = (UCI_STATE *) context;
+    MOVE bestmove, moves [MAX_MOVES + 10];
+    char string [8];
+
+    bestmove.from = 0;
+    uci->frame.bestmove_p = &bestmove;
+    eval_position (&uci->frame);
+
+    // the engine doesn't move in a position it considers drawn, but the GUI
+    // might not agree, so it gets the first legal move (if there is one)
+
+    if (!bestmove.from && generate_move_list (moves, &uci->frame.pos))
+        bestmove = moves [0];
+
+    // (the search also sets limits.stop when it runs out of time, so "stop"
+    // is noted separately)
+
+    pthread_mutex_lock (&uci->mutex);
+
+    while ((uci->infinite || uci->ponder) && !uci->stopped)
+        pthread_cond_wait (&uci->wake, &uci->mutex);
+
+    pthread_mutex_unlock (&uci->mutex);
+
+    printf ("bestmove %s\n", bestmove.from ? move_string (&bestmove, string) : "0000");
+    return NULL;
+}
+
+// This is called by the search after each iteration. Scores are converted
+// to centipawns assuming a pawn is worth about 10, and mates are reported
+// in moves (see mate_moves()).
+
+static void uci_report (SEARCH_LIMITS *limits, int score, MOVE pv [], int pv_length)
+{
+    long long elapsed = current_millisecs () - limits->start_time;
+    char line [MAX_DEPTH * 6 + 200], *cptr = line;
+    int pindex;
+
+    cptr += sprintf (cptr, "info depth %d ", limits->depth_completed);
+
+    if (score > 5000 || score < -5000)
+        cptr += sprintf (cptr, "score mate %d ", mate_moves (score, pv_length));
+    else
+        cptr += sprintf (cptr, "score cp %d ", score * 10);
+
+    cptr += sprintf (cptr, "nodes %lld nps %lld time %lld", limits->nodes_searched,
+        elapsed > 0 ? limits->nodes_searched * 1000 / elapsed : 0, elapsed);
+
+    if (pv_length)
+        cptr += sprintf (cptr, " pv");
+
+    for (pindex = 0; pindex < pv_length; ++pindex) {
+        *cptr++ = ' ';
+        move_string (pv + pindex, cptr);
+        cptr += strlen (cptr);
+    }
+
+    printf ("%s\n", line);
+}
+
+static int input_uci_move (char *in, MOVE *move)
+{
+    static const char promos [] = "nbrq";   // in order of piece value, starting with KNIGHT
+    int from, to;
+
+    if ((from = input_square_name (&in)) != 0 && (to = input_square_name (&in)) != 0) {
+        const char *promo = *in ? strchr (promos, tolower (*in)) : NULL;
+
+        move->from = from;
+        move->delta = to - from;
+        move->promo = promo ? (int) (promo - promos) + KNIGHT : 0;
+        return promo || !*in;
+    }
+
+    return FALSE;
+}
+
+// Batch mode (-A) analyzes every position in a file using eval_positions(),
+// which searches as many of them at once as there are threads. Each line is
+// a position in FEN or EPD (anything after the position, like EPD opcodes or
+// the move counters, is ignored if it can't be parsed), and lines that are
+// empty or start with '#' are skipped. The results are written (to stdout)
+// in the order the searches finish, so each has the index of its position.
+// Scores are in centipawns (like UCI and libfastchess), from the side to
+// move.
+
+typedef struct {
+    FILE *in;
+    int flags, depth, json, line_number;
+    SEARCH_LIMITS *limits;
+} BATCH_STATE;
+
+static int batch_next (void *context, FRAME *frame)
+{
+    BATCH_STATE *batch = (BATCH_STATE *) context;
+    char line [1024], *cptr;
+
+    while (fgets (line, sizeof (line), batch->in)) {
+        batch->line_number++;
+
+        for (cptr = line; isspace (*cptr); cptr++);
+
+        if (!*cptr || *cptr == '#')
+            continue;
+
+        if (!init_frame_fen (frame, frame->history, cptr)) {
+            fprintf (stderr, "line %d: invalid position\n", batch->line_number);
+            continue;
+        }
+
+        frame->depth = batch->depth;
+        frame->flags = batch->flags;
+        frame->limits_p = batch->limits;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void batch_done (void *context, int index, FRAME *frame, int score)
+{
+    BATCH_STATE *batch = (BATCH_STATE *) context;
+    char fen [MAX_FEN], move [8];
+
+    frame_fen (frame, fen);
+
+    if (frame->bestmove_p->from)
+        move_string (frame->bestmove_p, move);
+    else
+        strcpy (move, "0000");
+
+    if (batch->json)
+        printf ("{\"index\":%d,\"fen\":\"%s\",\"bestmove\":\"%s\",\"score\":%d,\"nodes\":%lld,\"depth\":%d}\n",
+            index, fen, move, score * 10, frame->limits_p->nodes_searched, frame->limits_p->depth_completed);
+    else
+        printf ("%d,%s,%s,%d,%lld,%d\n", index, fen, move, score * 10,
+            frame->limits_p->nodes_searched, frame->limits_p->depth_completed);
+
+    fflush (stdout);
+}
+
+static void run_batch (FILE *in, int max_threads, int flags, int depth, SEARCH_LIMITS *limits, int json)
+{
+    BATCH_STATE batch;
+
+    batch.in = in;
+    batch.flags = flags;
+    batch.depth = depth;
+    batch.json = json;
+    batch.limits = limits;
+    batch.line_number = 0;
+
+    if (!json)
+        printf ("index,fen,bestmove,score,nodes,depth\n");
+
+    eval_positions (max_threads, batch_next, batch_done, &batch);
+}
+
+// Benchmark mode (-Y) searches a fixed set of positions (openings, middle
+// games and endgames) to a fixed depth, first on one thread and then on all
+// of them. The single-threaded pass doesn't scramble the move order and
+// starts every position with a clear hash table (and the random numbers
+// from the same seed), so its total node count is a signature of the search
+// that only changes when the search itself does. The multi-threaded pass
+// searches the same positions to show the speedup (its node count varies).
+// Clearing the hash table isn't included in the times.
+
+static const char *bench_positions [] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2",
+    "r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3",
+    "rnbqkb1r/pp2pppp/3p1n2/8/3NP3/8/PPP2PPP/RNBQKB1R w KQkq - 1 5",
+    "rnbqk2r/ppp1ppbp/3p1np1/8/2PPP3/2N5/PP3PPP/R1BQKBNR w KQkq - 1 5",
+    "rnbqkb1r/ppp2ppp/4pn2/3p4/2PP4/2N5/PP2PPPP/R1BQKBNR w KQkq - 2 4",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r1bq1rk1/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQ1RK1 w - - 0 8",
+    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+    "2r3k1/pp3ppp/4p3/3n4/3P4/P4N2/1P3PPP/2R3K1 w - - 0 1",
+    "r1bqk2r/pp1nbppp/2p1pn2/3p4/2PP4/2N1PN2/PPQ2PPP/R1B1KB1R w KQkq - 2 7",
+    "r1b2rk1/2q1b1pp/p2ppn2/1p6/3QP3/1BN1B3/PPP3PP/R4RK1 w - - 0 1",
+    "2q1rr1k/3bbnnp/p2p1pp1/2pPp3/PpP1P1P1/1P2BNNP/2BQ1PRK/7R b - - 0 1",
+    "rnbqkb1r/p3pppp/1p6/2ppP3/3N4/2P5/PPP1QPPP/R1B1KB1R w KQkq - 0 1",
+    "r1b2rk1/2qnbppp/p2ppn2/1p4B1/3NPPP1/2N2Q2/PPP4P/2KR1B1R w - - 0 1",
+    "r1bqk2r/pp2bppp/2p5/3pP3/P2Q1P2/2N1B3/1PP3PP/R4RK1 b kq - 0 1",
+    "r2qnrnk/p2b2b1/1p1p2pp/2pPpp2/1PP1P3/PRNBB3/3QNPPP/5RK1 w - - 0 1",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "3r1rk1/p1q2pp1/1pb1p2p/2p5/2P1P3/P1BQ1N2/5PPP/3RR1K1 w - - 0 1",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "r2q1rk1/1ppnbppp/p2p1nb1/3Pp3/2P1P1P1/2N2N1P/PPB1QP2/R1B2RK1 b - - 0 1",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "8/8/1p1k4/p1p1p3/P1P1P3/1P3K2/8/8 w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/8/3k4/8/8/3K4/3R4 w - - 0 1",
+    "6k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1",
+    "8/8/3p4/1Pp3k1/2P5/7P/5K2/8 w - - 0 1",
+    "8/5pk1/7p/8/2R3P1/5K1P/8/1r6 b - - 0 1",
+    "r1b1k2r/ppp2ppp/2p5/2b1P3/4n3/2N2N2/PPP2PPP/R1BK1B1R w kq - 0 8",
+    "5rk1/1ppb3p/p1pb4/6q1/3P1p1r/2P1R2P/PP1BQ1P1/5RKN w - - 0 1",
+    "r4k1r/1b2bPR1/p4n1B/3p4/4P2P/1q5B/PpP5/1K4R1 w - - 0 1",
+};
+
+#define NUM_BENCH_POSITIONS (int) (sizeof (bench_positions) / sizeof (bench_positions [0]))
+
+// The threads searching a split point use the same selective search as one
+// thread would, so they shouldn't search many more nodes in total (some extra
+// is expected, since they can't all have the latest bounds). The benchmark
+// fails (returns FALSE) if the ratio of their nodes to one thread's is higher.
+// This doesn't apply to lazy SMP, where the helpers search extra on purpose.
+
+#define MAX_NODE_RATIO  1.5
+
+static int run_bench (int depth, int max_threads, int hash_megabytes, int flags)
+{
+    long long nodes [2] = { 0, 0 }, millisecs [2] = { 0, 0 };
+    int passes = max_threads > 1 ? 2 : 1, pass, pindex, result = TRUE;
+    uint64_t history [MAX_HISTORY];
+    SEARCH_LIMITS limits;
+    MOVE bestmove;
+    FRAME frame;
+
+    flags &= ~EVAL_SCRAMBLE;
+    init_random (0);
+
+    for (pass = 0; pass < passes; ++pass) {
+        int threads = pass ? max_threads : 1;
+
+        for (pindex = 0; pindex < NUM_BENCH_POSITIONS; ++pindex) {
+            long long start_time;
+            int score;
+
+            init_hash_table (hash_megabytes);
+            init_frame_fen (&frame, history, bench_positions [pindex]);
+            memset (&limits, 0, sizeof (limits));
+            frame.depth = depth;
+            frame.flags = flags;
+            frame.max_threads = threads;
+            frame.limits_p = &limits;
+            frame.bestmove_p = &bestmove;
+            bestmove.from = 0;
+
+            start_time = current_millisecs ();
+            score = (int) (long) eval_position (&frame);
+            millisecs [pass] += current_millisecs () - start_time;
+            nodes [pass] += limits.nodes_searched;
+
+            if (!pass) {
+                char move [8];
+
+                if (bestmove.from)
+                    move_string (&bestmove, move);
+                else
+                    strcpy (move, "0000");
+
+                printf ("%2d: bestmove %-5s score %5d  nodes %lld\n", pindex + 1, move, score, limits.nodes_searched);
+                fflush (stdout);
+            }
+        }
+
+        printf ("\n%d thread%s: %lld nodes in %.3f seconds, %.0f nodes/sec\n", threads, threads > 1 ? "s" : "",
+            nodes [pass], millisecs [pass] / 1000.0, nodes [pass] * 1000.0 / (millisecs [pass] ? millisecs [pass] : 1));
+    }
+
+    if (passes > 1) {
+        double ratio = (double) nodes [1] / (nodes [0] ? nodes [0] : 1);
+
+        printf ("speedup: %.2f\n", (double) millisecs [0] / (millisecs [1] ? millisecs [1] : 1));
+
+        if (!(flags & EVAL_LAZY_SMP)) {
+            printf ("node ratio: %.2f%s\n", ratio, ratio > MAX_NODE_RATIO ? " (too high!)" : "");
+            result = ratio <= MAX_NODE_RATIO;
+        }
+    }
+
+    printf ("signature: %lld\n", nodes [0]);
+    return result;
+}
+
 // partial Linux implementation of _kbhit()
 
 #ifndef _WIN32